@@ -28,6 +28,10 @@ public:
      */
     virtual request *make_write_req(const char *name,
                                     iovec *iov, int iovcnt) = 0;
+    /* write part of an object, without truncating it
+     */
+    virtual request *make_write_req(const char *name, size_t offset,
+                                    iovec *iov, int iovcnt) = 0;
     virtual request *make_read_req(const char *name, size_t offset,
                                     iovec *iov, int iovcnt) = 0;
     virtual request *make_read_req(const char *name, size_t offset,
@@ -16,6 +16,9 @@ extern int rbd_close(rbd_image_t image);
 extern int rbd_read(rbd_image_t image, uint64_t off, size_t len, char *buf);
 extern int rbd_write(rbd_image_t image, uint64_t off, size_t len, const char *buf);
 extern int rbd_flush(rbd_image_t image);
+extern int rbd_discard(rbd_image_t image, uint64_t off, uint64_t len);
+extern ssize_t rbd_write_zeroes(rbd_image_t image, uint64_t off, size_t len,
+                                int zero_flags, int op_flags);
 
 int do_init(struct bdus_ctx* ctx)
 {
@@ -40,6 +43,20 @@ int do_write(const char *buffer, uint64_t offset, uint32_t size, struct bdus_ctx
     return rbd_write(img, offset, size, buffer);
 }
 
+int do_discard(uint64_t offset, uint32_t size, struct bdus_ctx *ctx)
+{
+    rbd_image_t img = ctx->private_data;
+    return rbd_discard(img, offset, size);
+}
+
+int do_write_zeros(uint64_t offset, uint32_t size, bool may_unmap,
+                   struct bdus_ctx *ctx)
+{
+    rbd_image_t img = ctx->private_data;
+    ssize_t rv = rbd_write_zeroes(img, offset, size, 0, 0);
+    return rv < 0 ? rv : 0;
+}
+
 int do_flush(struct bdus_ctx *ctx)
 {
     rbd_image_t img = ctx->private_data;
@@ -56,10 +73,10 @@ static const struct bdus_ops device_ops =
     .read       = do_read,
     .write      = do_write,
     .write_same = NULL,
-    .write_zeros = NULL,
+    .write_zeros = do_write_zeros,
     .fua_write = NULL,
     .flush      = do_flush,
-    .discard = NULL,
+    .discard    = do_discard,
     .secure_erase = NULL,
     .ioctl = NULL
 };
@@ -0,0 +1,122 @@
+/*
+ * file:        compln_tracker.h
+ * description: tracks completion of object writes, which may finish
+ *              out of order, and wakes threads waiting for them
+ *
+ * author:      Peter Desnoyers, Northeastern University
+ * Copyright 2021, 2022 Peter Desnoyers
+ * license:     GNU LGPL v2.1 or newer
+ *              LGPL-2.1-or-later
+ */
+
+#ifndef COMPLN_TRACKER_H
+#define COMPLN_TRACKER_H
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+/* all objects seq < next() have been completed. Completions past
+ * next() are held in a deque indexed by (seq - next()), which grows
+ * as far as needed, so there's no limit on the number of objects in
+ * flight.
+ *
+ * next() is an atomic and can be read without any lock. The tracker
+ * has its own (leaf) lock, so completions don't contend with the
+ * translation layer lock; waiters are kept in a map by sequence
+ * number and only woken when their sequence number completes.
+ */
+class compln_tracker {
+    std::mutex m;
+    std::atomic<int> _next = 1;
+    std::deque<bool> done;	// done[i] -> seq (_next + i) complete
+
+    struct waiter {
+	std::condition_variable cv;
+	bool woken = false;
+    };
+    std::multimap<int,waiter*> waiters;
+
+public:
+    int next(void) {
+	return _next.load(std::memory_order_acquire);
+    }
+    bool ready(int seq) {
+	return seq < next();
+    }
+
+    /* only used at startup and recovery, when nothing is in flight
+     */
+    void set_next(int seq) {
+	std::unique_lock lk(m);
+	done.clear();
+	_next.store(seq, std::memory_order_release);
+    }
+
+    void complete(int seq) {
+	std::unique_lock lk(m);
+	int n = _next.load(std::memory_order_relaxed);
+	if (seq < n)
+	    return;
+	size_t i = seq - n;
+	if (i >= done.size())
+	    done.resize(i+1, false);
+	done[i] = true;
+
+	while (!done.empty() && done.front()) {
+	    done.pop_front();
+	    n++;
+	}
+	_next.store(n, std::memory_order_release);
+
+	auto end = waiters.lower_bound(n);
+	for (auto it = waiters.begin(); it != end; it++) {
+	    it->second->woken = true;
+	    it->second->cv.notify_one();
+	}
+	waiters.erase(waiters.begin(), end);
+    }
+
+    /* wait until @seq (and everything before it) is complete, or
+     * until wake_all(). The caller's lock is dropped while waiting,
+     * so callers re-check their conditions (e.g. shutdown) in a loop,
+     * same as with a condition variable.
+     */
+    void wait(int seq, std::unique_lock<std::mutex> &caller_lk) {
+	std::unique_lock lk(m);
+	if (seq < _next.load(std::memory_order_relaxed))
+	    return;
+	waiter w;
+	waiters.insert(std::make_pair(seq, &w));
+	caller_lk.unlock();
+	while (!w.woken)
+	    w.cv.wait(lk);
+	lk.unlock();
+	caller_lk.lock();
+    }
+
+    /* for shutdown
+     */
+    void wake_all(void) {
+	std::unique_lock lk(m);
+	for (auto [s, w] : waiters) {
+	    w->woken = true;
+	    w->cv.notify_one();
+	}
+	waiters.clear();
+    }
+
+    /* number of completions past next() we're holding onto
+     */
+    int pending(void) {
+	std::unique_lock lk(m);
+	int n = 0;
+	for (auto d : done)
+	    n += d;
+	return n;
+    }
+};
+
+#endif
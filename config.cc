@@ -71,32 +71,70 @@ int lsvd_config::read() {
 	    if (words.size() != 2)
 		continue;
 	    F_CONFIG_H_INT(words[0], words[1], batch_size);
+	    F_CONFIG_INT(words[0], words[1], batch_adaptive);
+	    F_CONFIG_H_INT(words[0], words[1], batch_min);
+	    F_CONFIG_H_INT(words[0], words[1], batch_max);
+	    F_CONFIG_H_INT(words[0], words[1], stream_part);
+	    F_CONFIG_H_INT(words[0], words[1], stream_hdr);
 	    F_CONFIG_INT(words[0], words[1], wcache_batch);
 	    F_CONFIG_H_INT(words[0], words[1], wcache_chunk);
 	    F_CONFIG_STR(words[0], words[1], cache_dir);
 	    F_CONFIG_INT(words[0], words[1], xlate_threads);
 	    F_CONFIG_INT(words[0], words[1], xlate_window);
+	    F_CONFIG_INT(words[0], words[1], xlate_refs);
+	    F_CONFIG_INT(words[0], words[1], crc_verify);
+	    F_CONFIG_INT(words[0], words[1], dedup_blocks);
 	    F_CONFIG_TABLE(words[0], words[1], backend, m);
 	    F_CONFIG_H_INT(words[0], words[1], cache_size);
 	    F_CONFIG_INT(words[0], words[1], hard_sync);
 	    F_CONFIG_INT(words[0], words[1], ckpt_interval);
+	    F_CONFIG_INT(words[0], words[1], ckpt_shard_entries);
+	    F_CONFIG_INT(words[0], words[1], ckpt_threads);
+	    F_CONFIG_INT(words[0], words[1], lazy_open);
 	    F_CONFIG_INT(words[0], words[1], flush_msec);
+	    F_CONFIG_H_INT(words[0], words[1], compact_obj_size);
+	    F_CONFIG_INT(words[0], words[1], compact_min_objs);
+	    F_CONFIG_INT(words[0], words[1], compact_max_objs);
+	    F_CONFIG_INT(words[0], words[1], compact_msec);
+	    F_CONFIG_INT(words[0], words[1], gc_threads);
+	    F_CONFIG_INT(words[0], words[1], gc_delete_grace);
+	    F_CONFIG_INT(words[0], words[1], defrag_mbps);
+	    F_CONFIG_INT(words[0], words[1], defrag_extents);
 	}
 	fp.close();
 	break;
     }
     
     ENV_CONFIG_H_INT(batch_size);
+    ENV_CONFIG_INT(batch_adaptive);
+    ENV_CONFIG_H_INT(batch_min);
+    ENV_CONFIG_H_INT(batch_max);
+    ENV_CONFIG_H_INT(stream_part);
+    ENV_CONFIG_H_INT(stream_hdr);
     ENV_CONFIG_INT(wcache_batch);
     ENV_CONFIG_H_INT(wcache_chunk);
     ENV_CONFIG_STR(cache_dir);
     ENV_CONFIG_INT(xlate_threads);
     ENV_CONFIG_INT(xlate_window);
+    ENV_CONFIG_INT(xlate_refs);
+    ENV_CONFIG_INT(crc_verify);
+    ENV_CONFIG_INT(dedup_blocks);
     ENV_CONFIG_TABLE(backend, m);
     ENV_CONFIG_H_INT(cache_size);
     ENV_CONFIG_INT(hard_sync);
     ENV_CONFIG_INT(ckpt_interval);
+    ENV_CONFIG_INT(ckpt_shard_entries);
+    ENV_CONFIG_INT(ckpt_threads);
+    ENV_CONFIG_INT(lazy_open);
     ENV_CONFIG_INT(flush_msec);
+    ENV_CONFIG_H_INT(compact_obj_size);
+    ENV_CONFIG_INT(compact_min_objs);
+    ENV_CONFIG_INT(compact_max_objs);
+    ENV_CONFIG_INT(compact_msec);
+    ENV_CONFIG_INT(gc_threads);
+    ENV_CONFIG_INT(gc_delete_grace);
+    ENV_CONFIG_INT(defrag_mbps);
+    ENV_CONFIG_INT(defrag_extents);
 
     return 0;			// success
 }
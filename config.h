@@ -18,16 +18,35 @@ class lsvd_config {
 public:
 
     int         batch_size = 8*1024*1024;   // in bytes
+    int         batch_adaptive = 0;         // pick size from backend perf
+    int         batch_min = 1*1024*1024;    // adaptive limits
+    int         batch_max = 32*1024*1024;
+    int         stream_part = 0;            // upload batch in parts, 0=off
+    int         stream_hdr = 64*1024;       // header space for streaming
     int         wcache_batch = 8;           // requests
     int         wcache_chunk = 2*1024*1024; // bytes
     std::string cache_dir = "/tmp";
     int         xlate_threads = 2;
     int         xlate_window = 8;
+    int         xlate_refs = 0;             // batches point into SSD journal
+    int         crc_verify = 8;             // check 1 in N reads, 0=off
+    int         dedup_blocks = 0;           // inline dedup index size, 0=off
     int         hard_sync = 0;
     enum cfg_backend backend = BACKEND_RADOS;
     long        cache_size = 100*1024*1024; // in bytes
     int         ckpt_interval = 500;        // objects 
-    int         flush_msec = 2000;          // flush timeout
+    int         ckpt_shard_entries = 1024*1024; // map entries per shard
+    int         ckpt_threads = 4;           // for sharded checkpoints
+    int         lazy_open = 0;              // load map shards on demand
+    int         flush_msec = 2000;          // batch deadline after 1st write
+    int         compact_obj_size = 2*1024*1024; // smaller objects get merged
+    int         compact_min_objs = 0;       // run length to trigger, 0=off
+    int         compact_max_objs = 256;     // max objects per cycle
+    int         compact_msec = 10000;       // min time between cycles
+    int         gc_threads = 2;             // concurrent GC workers
+    int         gc_delete_grace = 16;       // objects before deleting
+    int         defrag_mbps = 0;            // defrag bandwidth, 0=off
+    int         defrag_extents = 16;        // min. fragments per 1MB
     
     lsvd_config(){}
     ~lsvd_config(){ }
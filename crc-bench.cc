@@ -0,0 +1,55 @@
+/*
+ * checksum throughput for object data: CRC32C (hardware and table)
+ * vs. zlib crc32, over LSVD_CRC_CHUNK (64KB) pieces of a buffer
+ *
+ * usage: crc-bench [MB [chunk]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "crc32c.h"
+
+template<class F>
+void bench(const char *name, F crc, std::vector<char> &buf, size_t chunk) {
+    auto t0 = std::chrono::steady_clock::now();
+    uint32_t sum = 0;
+    int reps = 0;
+    double secs;
+    do {
+	for (size_t i = 0; i + chunk <= buf.size(); i += chunk)
+	    sum += crc(buf.data() + i, chunk);
+	reps++;
+	secs = std::chrono::duration<double>(std::chrono::steady_clock::now()
+					     - t0).count();
+    } while (secs < 1.0);
+    double mb = (double)reps * buf.size() / (1024*1024);
+    printf("%-12s %10.1f MB/s  (%08x)\n", name, mb / secs, sum);
+}
+
+int main(int argc, char **argv) {
+    size_t mb = argc > 1 ? atoi(argv[1]) : 64;
+    size_t chunk = argc > 2 ? atoi(argv[2]) : 64*1024;
+
+    std::vector<char> buf(mb * 1024 * 1024);
+    std::mt19937 rng(17);
+    for (auto &c : buf)
+	c = rng();
+
+    printf("%ld MB buffer, %ld byte chunks\n", mb, chunk);
+    if (crc32c_hw_ok())
+	bench("crc32c (hw)", [](const char *p, size_t n) {
+		return crc32c_hw(0, p, n);}, buf, chunk);
+    else
+	printf("crc32c (hw)  not supported\n");
+    bench("crc32c (tbl)", [](const char *p, size_t n) {
+	    return crc32c_sw(0, p, n);}, buf, chunk);
+    bench("zlib crc32", [](const char *p, size_t n) {
+	    return (uint32_t)crc32(0, (const unsigned char*)p, n);},
+	buf, chunk);
+}
@@ -0,0 +1,125 @@
+/*
+ * file:        crc32c.h
+ * description: CRC32C (Castagnoli) for object data, using the SSE4.2
+ *              or ARMv8 CRC instructions if present, else a table
+ *
+ * author:      Peter Desnoyers, Northeastern University
+ * Copyright 2021, 2022 Peter Desnoyers
+ * license:     GNU LGPL v2.1 or newer
+ *              LGPL-2.1-or-later
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/* same conventions as zlib crc32: start with 0, and pass the result
+ * of one call to the next to checksum a buffer in pieces.
+ */
+
+/* table fallback, slicing-by-8
+ */
+struct crc32c_table {
+    uint32_t t[8][256];
+    crc32c_table() {
+	for (int i = 0; i < 256; i++) {
+	    uint32_t c = i;
+	    for (int j = 0; j < 8; j++)
+		c = (c >> 1) ^ (0x82f63b78 & -(c & 1));
+	    t[0][i] = c;
+	}
+	for (int i = 0; i < 256; i++)
+	    for (int k = 1; k < 8; k++)
+		t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xff];
+    }
+};
+
+static inline uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len) {
+    static const crc32c_table tbl;
+    auto &t = tbl.t;
+    auto p = (const unsigned char*)buf;
+    crc = ~crc;
+    for (; len > 0 && ((uintptr_t)p & 7); len--)
+	crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    for (; len >= 8; len -= 8, p += 8) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	v ^= crc;
+	crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^
+	    t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff] ^
+	    t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^
+	    t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+    }
+    for (; len > 0; len--)
+	crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len) {
+    auto p = (const unsigned char*)buf;
+    uint64_t c = ~crc;
+    for (; len > 0 && ((uintptr_t)p & 7); len--)
+	c = _mm_crc32_u8(c, *p++);
+    for (; len >= 8; len -= 8, p += 8) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	c = _mm_crc32_u64(c, v);
+    }
+    for (; len > 0; len--)
+	c = _mm_crc32_u8(c, *p++);
+    return ~(uint32_t)c;
+}
+
+static inline bool crc32c_hw_ok(void) {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__)
+__attribute__((target("+crc")))
+static inline uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len) {
+    auto p = (const unsigned char*)buf;
+    crc = ~crc;
+    for (; len > 0 && ((uintptr_t)p & 7); len--)
+	crc = __crc32cb(crc, *p++);
+    for (; len >= 8; len -= 8, p += 8) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	crc = __crc32cd(crc, v);
+    }
+    for (; len > 0; len--)
+	crc = __crc32cb(crc, *p++);
+    return ~crc;
+}
+
+static inline bool crc32c_hw_ok(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#else
+static inline uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len) {
+    return crc32c_sw(crc, buf, len);
+}
+static inline bool crc32c_hw_ok(void) {
+    return false;
+}
+#endif
+
+static inline uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    static const bool hw = crc32c_hw_ok();
+    return hw ? crc32c_hw(crc, buf, len) : crc32c_sw(crc, buf, len);
+}
+
+#endif
@@ -107,7 +107,7 @@ namespace extmap {
     struct _lba2buf {
 	uint64_t    a    : 1;
 	uint64_t    d    : 1;
-	uint64_t    base : 38;
+	int64_t     base : 38;	// LBA, signed like the int64_t keys
 	uint64_t    len  : 24;
 	sector_ptr ptr;
     };
@@ -509,10 +509,12 @@ namespace extmap {
 
 	    verify_max();
 
-	    // special case inserting the first entry
+	    // special case inserting the first entry - or trimming an
+	    // empty map, which is a no-op
 	    //
 	    if (maxes.size() == 0) {
-		first(_e);
+		if (!trim)
+		    first(_e);
 		return;
 	    }
 
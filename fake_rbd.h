@@ -63,6 +63,15 @@ extern "C" void rbd_aio_release(rbd_completion_t c);
 extern "C" int rbd_aio_discard(rbd_image_t image, uint64_t off,
                                uint64_t len, rbd_completion_t c);
 
+extern "C" int rbd_discard(rbd_image_t image, uint64_t off, uint64_t len);
+
+extern "C" int rbd_aio_write_zeroes(rbd_image_t image, uint64_t off,
+                                    size_t len, rbd_completion_t c,
+                                    int zero_flags, int op_flags);
+
+extern "C" ssize_t rbd_write_zeroes(rbd_image_t image, uint64_t off,
+                                    size_t len, int zero_flags, int op_flags);
+
 extern "C" int rbd_aio_flush(rbd_image_t image, rbd_completion_t c);
 
 extern "C" int rbd_flush(rbd_image_t image);
@@ -100,7 +109,27 @@ extern "C" int rbd_open(rados_ioctx_t io, const char *name,
 extern "C" int rbd_close(rbd_image_t image);
 extern "C" int rbd_invalidate_cache(rbd_image_t image);
 
+extern "C" int rbd_snap_create(rbd_image_t image, const char *snapname);
+extern "C" int rbd_snap_list(rbd_image_t image, rbd_snap_info_t *snaps, int *max_snaps);
+extern "C" void rbd_snap_list_end(rbd_snap_info_t *snaps);
+extern "C" int rbd_snap_remove(rbd_image_t image, const char *snapname);
+extern "C" int rbd_snap_rollback(rbd_image_t image, const char *snapname);
+
+extern "C" int rbd_diff_iterate2(rbd_image_t image, const char *fromsnapname,
+                                 uint64_t ofs, uint64_t len,
+                                 uint8_t include_parent, uint8_t whole_object,
+                                 int (*cb)(uint64_t, size_t, int, void *),
+                                 void *arg);
+extern "C" int rbd_get_seq(rbd_image_t image);
+extern "C" int rbd_diff_iterate_seq(rbd_image_t image, int from_seq,
+                                    uint64_t ofs, uint64_t len,
+                                    int (*cb)(uint64_t, size_t, int, void *),
+                                    void *arg);
+
 extern "C" int rbd_create(rados_ioctx_t io, const char *name, uint64_t size, int *order);
+extern "C" int rbd_clone(rados_ioctx_t p_ioctx, const char *p_name,
+                         const char *p_snapname, rados_ioctx_t c_ioctx,
+                         const char *c_name, uint64_t features, int *c_order);
 extern "C" int rbd_remove(rados_ioctx_t io, const char *name);
 typedef int (*librbd_progress_fn_t)(uint64_t offset, uint64_t total, void *ptr);
 extern "C" int rbd_remove_with_progress(rados_ioctx_t io, const char *name,
@@ -109,10 +138,5 @@ extern "C" int rbd_remove_with_progress(rados_ioctx_t io, const char *name,
 /* These RBD functions are unimplemented and return errors
  */
 extern "C" int rbd_resize(rbd_image_t image, uint64_t size);
-extern "C" int rbd_snap_create(rbd_image_t image, const char *snapname);
-extern "C" int rbd_snap_list(rbd_image_t image, rbd_snap_info_t *snaps, int *max_snaps);
-extern "C" void rbd_snap_list_end(rbd_snap_info_t *snaps);
-extern "C" int rbd_snap_remove(rbd_image_t image, const char *snapname);
-extern "C" int rbd_snap_rollback(rbd_image_t image, const char *snapname);
 
 #endif
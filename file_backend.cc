@@ -72,6 +72,8 @@ public:
     /* async I/O
      */
     request *make_write_req(const char *name, iovec *iov, int iovcnt);
+    request *make_write_req(const char *name, size_t offset,
+                            iovec *iov, int iovcnt);
     request *make_read_req(const char *name, size_t offset,
                            iovec *iov, int iovcnt);
     request *make_read_req(const char *name, size_t offset,
@@ -173,6 +175,8 @@ class file_backend_req : public request {
     int             fd = -1;
     
 public:
+    bool            truncate = true; // false for partial writes
+
     file_backend_req(enum lsvd_op op_, const char *name_,
 		     iovec *iov, int iovcnt, size_t offset_,
 		     file_backend *be_) : _iovs(iov, iovcnt) {
@@ -198,8 +202,8 @@ public:
 	    close(fd);
 	}
 	else {
-	    if ((fd = open(name,
-			   O_RDWR | O_CREAT | O_TRUNC, 0777)) < 0)
+	    if ((fd = open(name, O_RDWR | O_CREAT |
+			   (truncate ? O_TRUNC : 0), 0777)) < 0)
 		throw("file object error");
 	    if (pwritev(fd, iov, niovs, offset) < 0)
 		throw("file object error");
@@ -258,6 +262,16 @@ request *file_backend::make_write_req(const char*name, iovec *iov, int niov) {
     return new file_backend_req(OP_WRITE, name, iov, niov, 0, this);
 }
 
+/* parts of a streamed object may arrive in any order; the
+ * header is written last
+ */
+request *file_backend::make_write_req(const char*name, size_t offset,
+				      iovec *iov, int niov) {
+    auto req = new file_backend_req(OP_WRITE, name, iov, niov, offset, this);
+    req->truncate = false;
+    return req;
+}
+
 request *file_backend::make_read_req(const char *name, size_t offset,
 				     iovec *iov, int iovcnt) {
     return new file_backend_req(OP_READ, name, iov, iovcnt, offset, this);
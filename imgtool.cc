@@ -0,0 +1,293 @@
+/*
+ * file:        imgtool.cc
+ * description: bulk import/export of LSVD images, going straight
+ *              to the translation layer without the SSD caches
+ *
+ * author:      Peter Desnoyers, Northeastern University
+ * Copyright 2021, 2022 Peter Desnoyers
+ * license:     GNU LGPL v2.1 or newer
+ *              LGPL-2.1-or-later
+ *
+ * usage: imgtool import <image> <file> [pool]
+ *        imgtool export <image> <file> [pool]
+ *        imgtool repack <image> [pool]
+ *
+ * import copies a raw image into a new (empty) LSVD image: full
+ * batches are written as data objects, up to xlate_window at a time,
+ * then a checkpoint. Zero blocks and holes in the file are skipped.
+ * export writes the mapped extents of the image to a file with
+ * xlate_window parallel reads; unmapped parts of a regular file are
+ * left as holes, but a block device isn't zeroed. Reads are CRC
+ * checked, and export fails if any of them (or any write) fails.
+ * repack rewrites all the live data in LBA order into new objects
+ * and deletes the old ones (see translate::repack), leaving one
+ * object per batch_size of data and a minimal map.
+ * Backend and batch settings come from lsvd.conf / LSVD_* as usual.
+ * Don't run any of them on an image which is open.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <uuid/uuid.h>
+
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+
+#include "lsvd_types.h"
+#include "extent.h"
+#include "backend.h"
+#include "translate.h"
+#include "config.h"
+
+extern backend *get_backend(lsvd_config *cfg, rados_ioctx_t io,
+			    const char *name);
+
+static double timestamp(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1.0e-6;
+}
+
+static const size_t io_size = 4*1024*1024;
+static size_t max_write;	// what the write cache would send
+
+static bool all_zero(const char *buf, size_t len) {
+    auto p = (const uint64_t*)buf;
+    for (size_t i = 0; i < len/8; i++)
+	if (p[i] != 0)
+	    return false;
+    return true;
+}
+
+/* write the non-zero 4KB blocks of buf[0..len) at @offset
+ */
+static void import_buf(translate *xlate, char *buf, size_t len,
+		       size_t offset) {
+    size_t i = 0;
+    while (i < len) {
+	for (; i < len && all_zero(buf+i, std::min(len-i, 4096UL)); i += 4096)
+	    ;
+	size_t base = i;
+	for (; i < len && !all_zero(buf+i, std::min(len-i, 4096UL)); i += 4096)
+	    ;
+	i = std::min(i, len);
+	for (; base < i; base += max_write) {
+	    iovec iov = {buf + base, std::min(max_write, i - base)};
+	    xlate->wait_for_room();
+	    xlate->writev(xlate->max_cache_seq, offset + base, &iov, 1);
+	}
+    }
+}
+
+static int do_import(translate *xlate, size_t vol_size, const char *file) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+	return perror(file), -1;
+    size_t bytes = lseek(fd, 0, SEEK_END);
+    if (bytes > vol_size) {
+	fprintf(stderr, "%s: %ld bytes, image is only %ld\n", file,
+		bytes, vol_size);
+	close(fd);
+	return -1;
+    }
+
+    /* anything not written reads as zero, so the image has to be new
+     */
+    xlate->load_map(0, vol_size);
+    if (xlate->mapsize() > 0) {
+	fprintf(stderr, "image isn't empty\n");
+	close(fd);
+	return -1;
+    }
+
+    char *buf = (char*)aligned_alloc(512, io_size);
+    size_t offset = 0, total = 0;
+    while (offset < bytes) {
+	/* skip holes in sparse files, if the filesystem tells us
+	 */
+	off_t data = lseek(fd, offset, SEEK_DATA);
+	if (data < 0 && errno == ENXIO)
+	    break;
+	off_t hole = (data < 0) ? -1 : lseek(fd, data, SEEK_HOLE);
+	size_t limit = bytes;
+	if (hole > data) {
+	    offset = data & ~4095L;
+	    limit = hole;
+	}
+
+	for (; offset < limit; offset += io_size) {
+	    size_t len = std::min(io_size, limit - offset);
+	    ssize_t n = pread(fd, buf, len, offset);
+	    if (n < 0) {
+		perror("read");
+		free(buf);
+		close(fd);
+		return -1;
+	    }
+	    if (n == 0) {
+		limit = offset;
+		break;
+	    }
+	    len = round_up(n, 512);
+	    memset(buf + n, 0, len - n);
+	    import_buf(xlate, buf, len, offset);
+	    total += n;
+	}
+	offset = limit;
+    }
+    free(buf);
+    close(fd);
+
+    if (xlate->checkpoint() < 0) {
+	fprintf(stderr, "checkpoint failed\n");
+	return -1;
+    }
+    xlate_stats s;
+    xlate->get_stats(&s);
+    printf("read %ld MB, wrote %ld objects (%ld MB)\n", total >> 20,
+	   s.objs_written, s.bytes_written >> 20);
+    return 0;
+}
+
+static int do_export(translate *xlate, size_t vol_size, const char *file,
+		     int nthreads) {
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+	return perror(file), -1;
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode))
+	if (ftruncate(fd, vol_size) < 0) {
+	    perror("ftruncate");
+	    close(fd);
+	    return -1;
+	}
+
+    /* mapped extents, cut into pieces of at most io_size
+     */
+    std::vector<std::pair<size_t,size_t>> pieces;
+    auto cb = [](uint64_t offset, size_t len, int exists, void *ptr) {
+	auto v = (std::vector<std::pair<size_t,size_t>>*)ptr;
+	for (size_t i = 0; i < len; i += io_size)
+	    v->push_back(std::make_pair(offset + i,
+					std::min(io_size, len - i)));
+	return 0;
+    };
+    xlate->map_iterate(0, 0, vol_size, cb, &pieces);
+
+    std::atomic<size_t> next(0), total(0);
+    std::atomic<int> errors(0), read_errors(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++)
+	threads.push_back(std::thread([&]() {
+		    char *buf = (char*)aligned_alloc(512, io_size);
+		    for (size_t j = next++; j < pieces.size(); j = next++) {
+			auto [offset, len] = pieces[j];
+			iovec iov = {buf, len};
+			if (xlate->readv(offset, &iov, 1) < 0)
+			    read_errors++;
+			if (pwrite(fd, buf, len, offset) < (ssize_t)len)
+			    errors++;
+			total += len;
+		    }
+		    free(buf);
+		}));
+    for (auto &t : threads)
+	t.join();
+
+    if (read_errors > 0 || errors > 0) {
+	fprintf(stderr, "%s: %d reads and %d writes failed\n", file,
+		read_errors.load(), errors.load());
+	close(fd);
+	return -1;
+    }
+    if (fsync(fd) < 0) {
+	perror("fsync");
+	close(fd);
+	return -1;
+    }
+    close(fd);
+    printf("wrote %ld MB in %ld extents\n", total >> 20, pieces.size());
+    return 0;
+}
+
+static int do_repack(translate *xlate, size_t vol_size, int nthreads) {
+    xlate_stats s0, s1;
+    xlate->get_stats(&s0);
+    xlate->load_map(0, vol_size);
+    int n0 = xlate->mapsize();
+    int rv = xlate->repack(nthreads);
+    if (rv < 0)
+	return fprintf(stderr, "repack: %s\n", strerror(-rv)), -1;
+    xlate->get_stats(&s1);
+    printf("map %d -> %d extents, deleted %d objects, wrote %ld (%ld MB)\n",
+	   n0, xlate->mapsize(), rv, s1.objs_written - s0.objs_written,
+	   (s1.bytes_written - s0.bytes_written) >> 20);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    bool repack = argc > 2 && !strcmp(argv[1], "repack");
+    if (!repack &&
+	(argc < 4 || (strcmp(argv[1], "import") && strcmp(argv[1], "export")))) {
+	fprintf(stderr, "usage: %s import|export <image> <file> [pool]\n"
+		"       %s repack <image> [pool]\n", argv[0], argv[0]);
+	exit(1);
+    }
+    bool import = !strcmp(argv[1], "import");
+    const char *name = argv[2], *file = repack ? NULL : argv[3];
+    int pool_arg = repack ? 3 : 4;
+
+    lsvd_config cfg;
+    if (cfg.read() < 0)
+	printf("error: config\n"), exit(1);
+
+    rados_t cluster = NULL;
+    rados_ioctx_t io_ctx = NULL;
+    if (cfg.backend == BACKEND_RADOS) {
+	const char *pool = argc > pool_arg ? argv[pool_arg] : "rbd";
+	if (rados_create(&cluster, NULL) < 0)
+	    printf("error: create\n"), exit(1);
+	if (rados_conf_read_file(cluster, NULL) < 0)
+	    printf("error: conf\n"), exit(1);
+	if (rados_connect(cluster) < 0)
+	    printf("error: connect\n"), exit(1);
+	if (rados_ioctx_create(cluster, pool, &io_ctx) < 0)
+	    printf("error: ioctx\n"), exit(1);
+    }
+    auto objstore = get_backend(&cfg, io_ctx, name);
+
+    extmap::objmap map;
+    std::shared_mutex map_lock;
+    auto xlate = make_translate(objstore, &cfg, &map, &map_lock);
+    ssize_t vol_size = xlate->init(name, cfg.xlate_threads, false);
+    if (vol_size < 0)
+	printf("error: can't open %s\n", name), exit(1);
+
+    max_write = std::min(cfg.batch_size, cfg.wcache_chunk);
+    double t0 = timestamp();
+    int nthreads = std::max(cfg.xlate_window, 1);
+    int rv = repack ? do_repack(xlate, vol_size, nthreads) :
+	import ? do_import(xlate, vol_size, file) :
+	do_export(xlate, vol_size, file, nthreads);
+    printf("%.1f seconds\n", timestamp() - t0);
+
+    xlate->shutdown();
+    delete xlate;
+    delete objstore;
+    if (cfg.backend == BACKEND_RADOS) {
+	rados_ioctx_destroy(io_ctx);
+	rados_shutdown(cluster);
+    }
+    return rv < 0 ? 1 : 0;
+}
@@ -36,7 +36,9 @@ enum {LSVD_J_DATA    = 10,
       LSVD_J_PAD     = 12,
       LSVD_J_SUPER   = 13,
       LSVD_J_W_SUPER = 14,
-      LSVD_J_R_SUPER = 15};
+      LSVD_J_R_SUPER = 15,
+      LSVD_J_MAP_SNAP = 16,
+      LSVD_J_TRIM    = 17};	// no data, extents are discarded
 
 /* for now we'll assume that all entries are contiguous
  */
@@ -87,6 +89,8 @@ struct j_write_super {
     int32_t len_start;	// type: j_length
     int32_t len_blocks;
     int32_t len_entries;
+
+    uint64_t valid_seq;		// older records are stale (rollback)
 } __attribute__((packed));
 
 /* probably in the third 4KB block, never gets overwritten (overwrite map in place)
@@ -129,6 +133,36 @@ struct j_super {
     uint32_t read_super;
 
     uuid_t   vol_uuid;
+
+    /* map snapshot region (j_map_snap), 0 in older cache files
+     */
+    uint32_t map_snap;
+    uint32_t map_snap_blocks;
+} __attribute__((packed));
+
+/* first block of the map snapshot region: a copy of the translation
+ * layer state as of checkpoint @ckpt, written at clean close. At open
+ * it's used in place of the checkpoint if @ckpt is still the newest one
+ * in the backend superblock. Arrays follow in the next blocks; offsets
+ * are in bytes from the start of this block.
+ */
+struct j_map_snap {
+    uint32_t magic;
+    uint32_t type;		// LSVD_J_MAP_SNAP
+    uint32_t version;		// 1
+
+    uuid_t   vol_uuid;
+    uint32_t ckpt;
+    uint64_t cache_seq;		// as recorded in the checkpoint
+    int32_t  blocks;		// 4KB blocks, including this one
+    uint32_t crc32;		// crc32c of blocks 1..blocks-1
+
+    uint32_t objs_offset;	// ckpt_obj
+    uint32_t objs_len;
+    uint32_t deletes_offset;	// deferred_delete
+    uint32_t deletes_len;
+    uint32_t map_offset;	// ckpt_mapentry
+    uint32_t map_len;
 } __attribute__((packed));
 
 #endif
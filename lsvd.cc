@@ -74,17 +74,15 @@ int rbd_image::image_open(rados_ioctx_t io, const char *name) {
 	return -1;
     objstore = get_backend(&cfg, io, name);
 
-    /* read superblock and initialize translation layer
-     */
-    xlate = make_translate(objstore, &cfg, &map, &map_lock);
-    size = xlate->init(name, cfg.xlate_threads, true);
-
     /* figure out cache file name, create it if necessary
      */
-    std::string cache = cfg.cache_filename(xlate->uuid, name);
+    uuid_t uuid;
+    if (translate_get_uuid(objstore, name, uuid) < 0)
+	return -1;
+    std::string cache = cfg.cache_filename(uuid, name);
     if (access(cache.c_str(), R_OK|W_OK) < 0) {
 	int cache_pages = cfg.cache_size / 4096;
-	if (make_cache(cache, xlate->uuid, cache_pages) < 0)
+	if (make_cache(cache, uuid, cache_pages) < 0)
 	    return -1;
     }
 
@@ -97,8 +95,16 @@ int rbd_image::image_open(rados_ioctx_t io, const char *name) {
 	return -1;
     if (js->magic != LSVD_MAGIC || js->type != LSVD_J_SUPER)
 	return -1;
-    if (memcmp(js->vol_uuid, xlate->uuid, sizeof(uuid_t)) != 0)
+    if (memcmp(js->vol_uuid, uuid, sizeof(uuid_t)) != 0)
 	throw("object and cache UUIDs don't match");
+
+    /* read superblock and initialize translation layer, from the
+     * map snapshot if it's current
+     */
+    xlate = make_translate(objstore, &cfg, &map, &map_lock);
+    if (js->map_snap_blocks > 0)
+	xlate->set_map_snapshot(fd, js->map_snap, js->map_snap_blocks);
+    size = xlate->init(name, cfg.xlate_threads, true);
     
     wcache = make_write_cache(js->write_super, fd, xlate, &cfg);
     rcache = make_read_cache(js->read_super, fd, false,
@@ -151,10 +157,12 @@ int rbd_image::image_close(void) {
     rcache->write_map();
     delete rcache;
     wcache->flush();
+    xlate->flush();		// may be reading from the write cache SSD
     wcache->do_write_checkpoint();
     delete wcache;
     xlate->wait_for_gc();
     xlate->checkpoint();
+    xlate->write_map_snapshot();
     delete xlate;
     delete objstore;
     close(fd);
@@ -252,20 +260,6 @@ extern "C" void rbd_aio_release(rbd_completion_t c)
     p->release();
 }
 
-extern "C" int rbd_aio_discard(rbd_image_t image, uint64_t off,
-			       uint64_t len, rbd_completion_t c)
-{
-    //do_log("rbd_aio_discard\n");
-    lsvd_completion *p = (lsvd_completion *)c;
-    p->img = (rbd_image*)image;
-
-    /* TODO: implement
-     */
-
-    p->complete(0);
-    return 0;
-}
-
 extern "C" int rbd_aio_flush(rbd_image_t image, rbd_completion_t c)
 {
     //do_log("'f', 0, 0, []\n");
@@ -328,6 +322,7 @@ class rbd_aio_req : public request {
     
     std::atomic<int>  n_req = 0;
     std::atomic<int>  status = 0;
+    std::atomic<int>  err = 0;	// e.g. -EIO from read cache
     std::mutex        m;
     std::condition_variable cv;
 
@@ -338,7 +333,7 @@ class rbd_aio_req : public request {
     void notify_parent(void) {
 	//assert(!m.try_lock());
         if (p != NULL) 
-            p->complete(sectors*512L);
+            p->complete(err ? (int)err : sectors*512L);
 	if (status & REQ_WAIT)
 	    cv.notify_all();
     }
@@ -398,8 +393,11 @@ class rbd_aio_req : public request {
     }
     
     void notify_r(request *child) {
-	if (child)
+	if (child) {
+	    if (child->error() < 0)
+		err = child->error();
 	    child->release();
+	}
 
 	std::unique_lock lk(m);
         if (--n_req > 0)
@@ -524,12 +522,20 @@ public:
      * with rbd_aio_completion and use its release() method
      */
     void wait() {
+	wait_rv();
+    }
+
+    /* wait, then return 0 or -errno
+     */
+    int wait_rv() {
 	assert(status & REQ_WAIT);
 	std::unique_lock lk(m);
 	while (! (status & REQ_COMPLETE))
 	    cv.wait(lk);
 	lk.unlock();
+	int rv = err;
 	delete this;
+	return rv;
     }
 
     void release() {}
@@ -611,8 +617,7 @@ extern "C" int rbd_read(rbd_image_t image, uint64_t off, size_t len, char *buf)
     auto req = new rbd_aio_req(OP_READ, img, NULL, off, REQ_WAIT, buf, len);
     
     req->run(NULL);
-    req->wait();
-    return 0;
+    return req->wait_rv();
 }
 
 extern "C" int rbd_write(rbd_image_t image, uint64_t off, size_t len, const char *buf)
@@ -626,6 +631,119 @@ extern "C" int rbd_write(rbd_image_t image, uint64_t off, size_t len, const char
     return 0;
 }
 
+/* rbd_trim_req - discard and write-zeroes, which are the same thing
+ * below here since unmapped sectors read as zero. Goes through the
+ * write cache, as a header-only journal record per max_wcache_trim
+ * sectors, which passes it on to the translation layer. Partial
+ * sectors are ignored (discard) or rejected (write-zeroes).
+ */
+class rbd_trim_req : public request {
+    rbd_image        *img;
+    lsvd_completion  *p;
+    sector_t          base, limit;
+    std::atomic<int>  n_req = 1; // dropped once all pieces are sent
+    bool              done = false;
+    std::mutex        m;
+    std::condition_variable cv;
+
+public:
+    rbd_trim_req(rbd_image *img_, lsvd_completion *p_, uint64_t off,
+		 uint64_t len) : img(img_), p(p_) {
+	base = div_round_up(off, 512);
+	limit = (off + len) / 512;
+    }
+    ~rbd_trim_req() {}
+
+    void run(request *parent /* unused */) {
+	for (sector_t lba = base; lba < limit; lba += max_wcache_trim) {
+	    n_req++;
+	    img->wcache->get_room(8); // one header page
+	    img->wcache->trim(this, lba, std::min(limit - lba,
+						  max_wcache_trim));
+	}
+	notify(NULL);
+    }
+
+    /* @child is really the write_cache_work, see rbd_aio_req
+     */
+    void notify(request *child) {
+	if (child)
+	    img->wcache->release_room(8);
+	if (--n_req > 0)
+	    return;
+	if (p != NULL) {
+	    p->complete(0);
+	    delete this;
+	    return;
+	}
+	std::unique_lock lk(m);
+	done = true;
+	cv.notify_all();
+    }
+
+    void wait() {
+	std::unique_lock lk(m);
+	while (!done)
+	    cv.wait(lk);
+	lk.unlock();
+	delete this;
+    }
+    
+    void release() {}
+};
+
+extern "C" int rbd_aio_discard(rbd_image_t image, uint64_t off,
+			       uint64_t len, rbd_completion_t c)
+{
+    //do_log("rbd_aio_discard\n");
+    rbd_image *img = (rbd_image*)image;
+    lsvd_completion *p = (lsvd_completion *)c;
+    p->img = img;
+
+    p->req = new rbd_trim_req(img, p, off, len);
+    p->req->run(NULL);
+    return 0;
+}
+
+extern "C" int rbd_discard(rbd_image_t image, uint64_t off, uint64_t len)
+{
+    rbd_image *img = (rbd_image*)image;
+    auto req = new rbd_trim_req(img, NULL, off, len);
+    req->run(NULL);
+    req->wait();
+    return 0;
+}
+
+/* flags are ignored - there's no way to zero a range other than
+ * unmapping it
+ */
+extern "C" int rbd_aio_write_zeroes(rbd_image_t image, uint64_t off,
+				    size_t len, rbd_completion_t c,
+				    int zero_flags, int op_flags)
+{
+    if (off % 512 || len % 512)
+	return -EINVAL;
+    rbd_image *img = (rbd_image*)image;
+    lsvd_completion *p = (lsvd_completion *)c;
+    p->img = img;
+
+    p->req = new rbd_trim_req(img, p, off, len);
+    p->req->run(NULL);
+    return 0;
+}
+
+extern "C" ssize_t rbd_write_zeroes(rbd_image_t image, uint64_t off,
+				    size_t len, int zero_flags, int op_flags)
+{
+    if (off % 512 || len % 512)
+	return -EINVAL;
+    rbd_image *img = (rbd_image*)image;
+    auto req = new rbd_trim_req(img, NULL, off, len);
+    req->run(NULL);
+    req->wait();
+    return len;
+}
+
 extern "C" int rbd_aio_wait_for_complete(rbd_completion_t c)
 {
     lsvd_completion *p = (lsvd_completion *)c;
@@ -682,15 +800,34 @@ extern "C" int rbd_create(rados_ioctx_t io, const char *name, uint64_t size,
     return rv;
 }
 
-/* TODO: translate.cc should implement rbd_remove, by reading the 
- * last checkpoint and figuring out exactly which objects to remove
+/* the clone shares the parent's objects up to @p_snapname, which has
+ * to stay around as long as the clone does. Both have to be in the
+ * same pool, since object names don't say which pool they're in.
+ */
+extern "C" int rbd_clone(rados_ioctx_t p_ioctx, const char *p_name,
+			 const char *p_snapname, rados_ioctx_t c_ioctx,
+			 const char *c_name, uint64_t features, int *c_order)
+{
+    if (p_ioctx != c_ioctx)
+	return -EXDEV;
+    lsvd_config  cfg;
+    if (cfg.read() < 0)
+	return -1;
+    auto objstore = get_backend(&cfg, c_ioctx, NULL);
+    auto rv = translate_clone_image(objstore, p_name, p_snapname, c_name);
+    delete objstore;
+    return rv;
+}
+
+/* TODO: translate.cc should figure out exactly which objects to
+ * remove from the last checkpoint, rather than deleting by prefix
  */
 extern "C" int rbd_remove(rados_ioctx_t io, const char *name) {
     lsvd_config  cfg;
     if (cfg.read() < 0)
 	return -1;
     auto objstore = get_backend(&cfg, io, NULL);
-    int rv = objstore->delete_prefix(name);
+    int rv = translate_remove_image(objstore, name);
     delete objstore;
     return rv;
 }
@@ -700,37 +837,129 @@ extern "C" void rbd_uuid(rbd_image_t image, uuid_t *uuid) {
     memcpy(uuid, img->xlate->uuid, sizeof(uuid_t));
 }
 
-/* any following functions are stubs only
+/* snapshots are checkpoints that the translation layer keeps, along
+ * with the objects they point to - see translate::snap_create
  */
-extern "C" int rbd_invalidate_cache(rbd_image_t image)
+extern "C" int rbd_snap_create(rbd_image_t image, const char *snapname)
 {
-    return 0;
+    rbd_image *img = (rbd_image*)image;
+    img->wcache->flush();	// so it's in the snapshot
+    return img->xlate->snap_create(snapname);
 }
 
-/* These RBD functions are unimplemented and return errors
+/* same conventions as librbd: the list ends with a NULL name, and
+ * if there's no room we return -ERANGE with the size needed
  */
-extern "C" int rbd_resize(rbd_image_t image, uint64_t size)
-{
-    return -1;
-}
-
-extern "C" int rbd_snap_create(rbd_image_t image, const char *snapname)
-{
-    return -1;
-}
 extern "C" int rbd_snap_list(rbd_image_t image, rbd_snap_info_t *snaps,
                                int *max_snaps)
 {
-    return -1;
+    rbd_image *img = (rbd_image*)image;
+    std::vector<std::pair<int,std::string>> list;
+    img->xlate->snap_list(list);
+    if (*max_snaps < (int)list.size() + 1) {
+	*max_snaps = list.size() + 1;
+	return -ERANGE;
+    }
+    int i = 0;
+    for (auto const &[seq, name] : list)
+	snaps[i++] = (rbd_snap_info_t){.id = (uint64_t)seq,
+				       .size = (uint64_t)img->size,
+				       .name = strdup(name.c_str())};
+    snaps[i] = (rbd_snap_info_t){.id = 0, .size = 0, .name = NULL};
+    return list.size();
 }
+
 extern "C" void rbd_snap_list_end(rbd_snap_info_t *snaps)
 {
+    for (; snaps->name != NULL; snaps++) {
+	free((void*)snaps->name);
+	snaps->name = NULL;
+    }
 }
+
 extern "C" int rbd_snap_remove(rbd_image_t image, const char *snapname)
 {
-    return -1;
+    rbd_image *img = (rbd_image*)image;
+    return img->xlate->snap_remove(snapname);
 }
+
+/* newer data in the write cache would show through the rolled-back
+ * map, so first discard the whole volume - through the journal, so
+ * that it stays discarded after a crash - and push that out to the
+ * backend. If we crash before the rollback is done the volume reads
+ * as zeros; roll back again. No I/O may be in flight.
+ */
 extern "C" int rbd_snap_rollback(rbd_image_t image, const char *snapname)
+{
+    rbd_image *img = (rbd_image*)image;
+    std::vector<std::pair<int,std::string>> list;
+    img->xlate->snap_list(list);
+    if (std::find_if(list.begin(), list.end(), [&](auto &s) {
+		return s.second == snapname;}) == list.end())
+	return -ENOENT;
+
+    /* everything goes to the backend, the write cache forgets it,
+     * then the backend switches maps in one checkpoint. A crash at
+     * any point leaves either the old or the rolled-back volume.
+     */
+    img->wcache->flush();
+    img->xlate->flush();
+    img->wcache->invalidate();
+    return img->xlate->snap_rollback(snapname);
+}
+
+/* allocated extents (@fromsnapname NULL) or changes since a snapshot,
+ * as seen by a fresh open - i.e. everything written so far. LSVD has
+ * no parent images to include (clones share their base's extents)
+ * and no fixed-size objects, so @include_parent and @whole_object are
+ * ignored.
+ */
+extern "C" int rbd_diff_iterate2(rbd_image_t image, const char *fromsnapname,
+				 uint64_t ofs, uint64_t len,
+				 uint8_t include_parent, uint8_t whole_object,
+				 int (*cb)(uint64_t, size_t, int, void *),
+				 void *arg)
+{
+    rbd_image *img = (rbd_image*)image;
+    img->wcache->flush();
+    img->xlate->flush();
+    if (fromsnapname == NULL)
+	return img->xlate->map_iterate(0, ofs, len, cb, arg);
+    return img->xlate->diff_iterate(fromsnapname, ofs, len, cb, arg);
+}
+
+/* LSVD only - incremental backup without snapshots: save
+ * rbd_get_seq() along with each backup, and pass it to the next
+ * one. Discards aren't reported; -ENOTSUP if dedup is on.
+ */
+extern "C" int rbd_get_seq(rbd_image_t image)
+{
+    rbd_image *img = (rbd_image*)image;
+    img->wcache->flush();
+    return img->xlate->flush();
+}
+
+extern "C" int rbd_diff_iterate_seq(rbd_image_t image, int from_seq,
+				    uint64_t ofs, uint64_t len,
+				    int (*cb)(uint64_t, size_t, int, void *),
+				    void *arg)
+{
+    rbd_image *img = (rbd_image*)image;
+    img->wcache->flush();
+    img->xlate->flush();
+    return img->xlate->map_iterate(from_seq, ofs, len, cb, arg);
+}
+
+/* any following functions are stubs only
+ */
+extern "C" int rbd_invalidate_cache(rbd_image_t image)
+{
+    return 0;
+}
+
+/* These RBD functions are unimplemented and return errors
+ */
+extern "C" int rbd_resize(rbd_image_t image, uint64_t size)
 {
     return -1;
 }
@@ -30,6 +30,10 @@ class translate:
         assert (nbytes % 512) == 0 and (offset % 512) == 0
         return lsvd_lib.xlate_write(self.lsvd, data, c_ulong(offset), c_uint(nbytes))
 
+    def trim(self, offset, nbytes):
+        assert (nbytes % 512) == 0 and (offset % 512) == 0
+        return lsvd_lib.xlate_trim(self.lsvd, c_ulong(offset), c_ulong(nbytes))
+
     def read(self, offset, nbytes):
         assert (nbytes % 512) == 0 and (offset % 512) == 0
         buf = (c_char * nbytes)()
@@ -61,6 +65,11 @@ class translate:
     def checkpoint(self):
         return lsvd_lib.xlate_checkpoint(self.lsvd)
 
+    def stats(self):
+        s = xlate_stats()
+        lsvd_lib.xlate_get_stats(self.lsvd, byref(s))
+        return s
+
     def fakemap_update(self, base, limit, obj, offset):
         lsvd_lib.fakemap_update(self.lsvd, c_int(base), c_int(limit),
                                     c_int(obj), c_int(offset))
@@ -80,7 +80,7 @@ extern "C" int dbg_lsvd_read(rbd_image_t image, char *buffer, uint64_t offset, u
 {
     auto xlate = image_2_xlate(image);
     iovec iov = {buffer, size};
-    size_t val = xlate->readv(offset, &iov, 1);
+    ssize_t val = xlate->readv(offset, &iov, 1);
     return val < 0 ? -1 : 0;
 }
 extern "C" int dbg_lsvd_flush(rbd_image_t image)
@@ -116,7 +116,7 @@ extern "C" int xlate_size(_dbg *d)
 extern "C" int xlate_read(_dbg *d, char *buffer, uint64_t offset, uint32_t size)
 {
     iovec iov = {buffer, size};
-    size_t val = d->lsvd->readv(offset, &iov, 1);
+    ssize_t val = d->lsvd->readv(offset, &iov, 1);
     return val < 0 ? -1 : 0;
 }
 extern "C" int xlate_write(_dbg *d, char *buffer, uint64_t offset, uint32_t size)
@@ -125,6 +125,11 @@ extern "C" int xlate_write(_dbg *d, char *buffer, uint64_t offset, uint32_t size
     size_t val = d->lsvd->writev(0, offset, &iov, 1);
     return val < 0 ? -1 : 0;
 }
+extern "C" int xlate_trim(_dbg *d, uint64_t offset, uint64_t len)
+{
+    ssize_t val = d->lsvd->trim(0, offset, len);
+    return val < 0 ? -1 : 0;
+}
 int getmap_cb(void *ptr, int base, int limit, int obj, int offset)
 {
     getmap_s *s = (getmap_s*)ptr;
@@ -143,6 +148,11 @@ extern "C" int xlate_frontier(_dbg *d)
     return d->lsvd->frontier();
 }
 
+extern "C" void xlate_get_stats(_dbg *d, xlate_stats *s)
+{
+    d->lsvd->get_stats(s);
+}
+
 extern int batch_seq(translate*);
 extern "C" int xlate_seq(_dbg *d)
 {
@@ -7,10 +7,24 @@ class tuple(Structure):
                 ("offset", c_int),
                 ("plba",   c_int)]
 
+class xlate_stats(Structure):
+    _fields_ = [("objs_per_sec",  c_double),
+                ("batch_size",    c_ulong),
+                ("objs_written",  c_ulong),
+                ("bytes_written", c_ulong),
+                ("size_hist",     c_ulong * 16),
+                ("crc_checks",    c_ulong),
+                ("crc_errors",    c_ulong),
+                ("dedup_lookups", c_ulong),
+                ("dedup_hits",    c_ulong),
+                ("dedup_entries", c_ulong),
+                ("trimmed_sectors", c_ulong)]
+
 LSVD_SUPER = 1
 LSVD_DATA = 2
 LSVD_CKPT = 3
 LSVD_MAGIC = 0x4456534c
+LSVD_OBJ_VERSION = 2    # data/ckpt; superblock is still 1
 
 # these match version 453d93 of objects.cc
 
@@ -62,8 +76,19 @@ class data_hdr(Structure):
                 ("objs_cleaned_offset", c_uint),
                 ("objs_cleaned_len",    c_uint),
                 ("map_offset",          c_uint),
-                ("map_len",             c_uint)]
-sizeof_data_hdr = sizeof(data_hdr) # 24
+                ("map_len",             c_uint),
+                ("crcs_offset",         c_uint),
+                ("crcs_len",            c_uint),
+                ("index_offset",        c_uint),
+                ("index_len",           c_uint),
+                ("dedup_offset",        c_uint),
+                ("dedup_len",           c_uint),
+                ("trim_offset",         c_uint),
+                ("trim_len",            c_uint)]
+sizeof_data_hdr = sizeof(data_hdr) # 56
+sizeof_data_hdr_v1 = 24 # up to map_len
+
+LSVD_CRC_CHUNK = 64*1024
 
 class obj_cleaned(Structure):
     _pack_ = 1
@@ -77,6 +102,13 @@ class data_map(LittleEndianStructure):
                 ("len",                 c_ulong, 28)]
 sizeof_data_map = sizeof(data_map) # 8
 
+class data_index(LittleEndianStructure):
+    _pack_ = 1
+    _fields_ = [("lba",                 c_ulong, 36),
+                ("len",                 c_ulong, 28),
+                ("offset",              c_uint)]
+sizeof_data_index = sizeof(data_index) # 12
+
 class ckpt_hdr(Structure):
     _pack_ = 1
     _fields_ = [("cache_seq",           c_ulong),
@@ -87,8 +119,18 @@ class ckpt_hdr(Structure):
                 ("deletes_offset",      c_uint),
                 ("deletes_len",         c_uint),
                 ("map_offset",          c_uint),
-                ("map_len",             c_uint)]
-sizeof_ckpt_hdr = sizeof(ckpt_hdr) # 40
+                ("map_len",             c_uint),
+                ("shards_offset",       c_uint),
+                ("shards_len",          c_uint)]
+sizeof_ckpt_hdr = sizeof(ckpt_hdr) # 48
+sizeof_ckpt_hdr_v1 = 40 # no shards
+
+class ckpt_shard(Structure):
+    _pack_ = 1
+    _fields_ = [("base",                c_long),
+                ("limit",               c_long),
+                ("n_entries",           c_uint)]
+sizeof_ckpt_shard = sizeof(ckpt_shard) # 20
 
 class ckpt_obj(Structure):
     _pack_ = 1
@@ -143,6 +185,8 @@ LSVD_J_PAD     = 12
 LSVD_J_SUPER   = 13
 LSVD_J_W_SUPER = 14
 LSVD_J_R_SUPER = 15
+LSVD_J_MAP_SNAP = 16
+LSVD_J_TRIM    = 17
 
 class j_hdr(Structure):
     _pack_ = 1
@@ -174,7 +218,8 @@ class j_write_super(Structure):
                 ("map_entries", c_int),
                 ("len_start",   c_int),
                 ("len_blocks",  c_int),
-                ("len_entries", c_int)]
+                ("len_entries", c_int),
+                ("valid_seq",   c_ulong)]
 sizeof_j_write_super = sizeof(j_write_super)
 
 class j_read_super(Structure):
@@ -196,9 +241,29 @@ class j_super(Structure):
                 ("version",      c_uint),
                 ("write_super",  c_uint),
                 ("read_super",   c_uint),
-                ("vol_uuid",     c_ubyte*16)]
+                ("vol_uuid",     c_ubyte*16),
+                ("map_snap",     c_uint),
+                ("map_snap_blocks", c_uint)]
 sizeof_j_super = sizeof(j_super)
 
+class j_map_snap(Structure):
+    _pack_ = 1
+    _fields_ = [("magic",          c_uint),
+                ("type",           c_uint),
+                ("version",        c_uint),
+                ("vol_uuid",       c_ubyte*16),
+                ("ckpt",           c_uint),
+                ("cache_seq",      c_ulong),
+                ("blocks",         c_int),
+                ("crc32",          c_uint),
+                ("objs_offset",    c_uint),
+                ("objs_len",       c_uint),
+                ("deletes_offset", c_uint),
+                ("deletes_len",    c_uint),
+                ("map_offset",     c_uint),
+                ("map_len",        c_uint)]
+sizeof_j_map_snap = sizeof(j_map_snap)
+
 class iovec(Structure):
     _fields_ = [('iov_base', c_void_p),
                 ('iov_len', c_size_t)]
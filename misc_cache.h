@@ -2,6 +2,7 @@
  * file:        misc_cache.h
  * description: grab-bag of various classes and structures:
  *              -thread_pool
+ *		-parallel_for
  *		-sized_vector for caches
  *		-objmap (map shared by translate, read_cache)
  *
@@ -19,6 +20,9 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 
 /* implements a thread pool with a work queue of type T
  * to use, push threads onto thread_pool.pool
@@ -80,6 +84,21 @@ public:
     }
 };
 
+/* run f(0) .. f(n-1) on up to @threads threads, and wait for them
+ */
+template <class F>
+void parallel_for(int n, int threads, F f) {
+    std::atomic<int> next = 0;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::min(n, threads); i++)
+        workers.push_back(std::thread([&]() {
+                    for (int j = next++; j < n; j = next++)
+                        f(j);
+                }));
+    for (auto &t : workers)
+        t.join();
+}
+
 /* nice error messages
  */
 #include <experimental/filesystem>
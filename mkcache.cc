@@ -24,7 +24,10 @@ int make_cache(std::string name, uuid_t &uuid, int n_pages) {
     page_t r_units = 0.66 * n_pages / 16;
     page_t r_pages = r_units * 16;
     page_t r_meta = div_round_up(r_units * sizeof(extmap::obj_offset), 4096);
-    page_t w_pages = n_pages - r_pages - r_meta - 3;
+    page_t m_pages = n_pages / 32; // map snapshot, 2M entries per GB
+    page_t w_pages = n_pages - r_pages - r_meta - m_pages - 3;
+    page_t r_base = 3 + w_pages;
+    page_t m_base = r_base + r_meta + r_pages;
     
     FILE *fp = fopen(name.c_str(), "wb");
     if (fp == NULL)
@@ -38,7 +41,9 @@ int make_cache(std::string name, uuid_t &uuid, int n_pages) {
 		     1,   // version
 		     1,   // write superblock offset
 		     2,   // read superblock offset
-		     {0}};// uuid
+		     {0}, // uuid
+		     (uint32_t)m_base,  // map snapshot region
+		     (uint32_t)m_pages};
     memcpy(sup->vol_uuid, uuid, sizeof(uuid_t));
     fwrite(buf, 4096, 1, fp);
 
@@ -63,8 +68,6 @@ int make_cache(std::string name, uuid_t &uuid, int n_pages) {
 			       0,0,0};	   // len_start/blocks/entries
     fwrite(buf, 4096, 1, fp);
 
-    page_t r_base = 3 + w_pages + w_meta;
-
     memset(buf, 0, sizeof(buf));
     auto r_super = (j_read_super*)buf;
     *r_super = (j_read_super){LSVD_MAGIC,
@@ -78,7 +81,7 @@ int make_cache(std::string name, uuid_t &uuid, int n_pages) {
     fwrite(buf, 4096, 1, fp);
 
     memset(buf, 0, 4096);
-    for (int i = 3; i < 3 + w_pages + w_meta + r_pages + r_meta; i++)
+    for (int i = 3; i < m_base + m_pages; i++)
 	fwrite(buf, 4096, 1, fp);
     fclose(fp);
 
@@ -1,6 +1,6 @@
 #!/usr/bin/python3
 
-import lsvd
+import lsvd_types as lsvd
 import sys
 import os
 import argparse
@@ -31,13 +31,23 @@ def parse_size(size):
     else:
         return int(size)
 
-# backend batch size is 8MB, write cache should be >= 2 batches
-# 
-def mkcache(name, uuid=b'\0'*16, write_zeros=True, wblks=4096, rblks=4096):
+# same layout as mkcache.cc: superblocks in pages 0-2, then the write
+# cache, the read cache map and data, and the map snapshot area at the end
+#
+def mkcache(name, uuid=b'\0'*16, write_zeros=True, pages=8192):
     fd = os.open(name, os.O_RDWR | os.O_CREAT, 0o777)
 
+    r_units = int(0.66*pages) // 16
+    r_pages = r_units * 16
+    r_meta = div_round_up(r_units*lsvd.sizeof_obj_offset, 4096)
+    m_pages = pages // 32
+    w_pages = pages - r_pages - r_meta - m_pages - 3
+    r_base = 3 + w_pages
+    m_base = r_base + r_meta + r_pages
+
     sup = lsvd.j_super(magic=lsvd.LSVD_MAGIC, type=lsvd.LSVD_J_SUPER,
-                       write_super=1, read_super=2, backend_type=lsvd.LSVD_BE_FILE)
+                       version=1, write_super=1, read_super=2,
+                       map_snap=m_base, map_snap_blocks=m_pages)
     sup.vol_uuid[:] = uuid
     data = bytearray() + sup
     data += b'\0' * (4096-len(data))
@@ -47,45 +57,38 @@ def mkcache(name, uuid=b'\0'*16, write_zeros=True, wblks=4096, rblks=4096):
     # extent + 8 bytes length per 4KB, but we need an integer
     # number of pages for each section, and enough room for 2.
     #
-    _map = div_round_up(wblks, 256)
-    _len = div_round_up(wblks, 512)
-    mblks = 2 * (_map + _len)
-    wblks -= mblks
-    
-    # write cache has 125 single-page entries. default: map_blocks = map_entries = 0
+    _map = div_round_up(w_pages, 256)
+    _len = div_round_up(w_pages, 512)
+    w_meta = 2 * (_map + _len)
+    w_pages -= w_meta
+
     wsup = lsvd.j_write_super(magic=lsvd.LSVD_MAGIC, type=lsvd.LSVD_J_W_SUPER,
-                                seq=1, meta_base = 3, meta_limit = 3+mblks,
-                                base=3+mblks, limit=3+mblks+wblks,
-                                next=3+mblks, oldest=3+mblks, clean=1)
+                              version=1, clean=1, seq=1,
+                              meta_base=3, meta_limit=3+w_meta,
+                              base=3+w_meta, limit=3+w_meta+w_pages,
+                              next=3+w_meta)
     data = bytearray() + wsup
     data += b'\0' * (4096-len(data))
     os.write(fd, data) # page 1
 
-    rbase = wblks+mblks+3
-    units = rblks // 16
-    map_blks = div_round_up(units*lsvd.sizeof_obj_offset, 4096)
-    
-    # 1 page for map
     rsup = lsvd.j_read_super(magic=lsvd.LSVD_MAGIC, type=lsvd.LSVD_J_R_SUPER,
-                                unit_size=128, units=units,
-                                map_start=rbase, map_blocks=map_blks,
-                                base=rbase+map_blks)
-
+                             version=1, unit_size=128,
+                             base=r_base+r_meta, units=r_units,
+                             map_start=r_base, map_blocks=r_meta)
     data = bytearray() + rsup
     data += b'\0' * (4096-len(data))
     os.write(fd, data) # page 2
 
-    # zeros are invalid entries for cache map
-    # 130 + 16*(64KB/4KB) = 386
-
+    # zeros are invalid entries for the cache map, and an empty map snapshot
+    #
     data = bytearray(b'\0'*4096)
     if (write_zeros):
-        for i in range(3 + mblks + wblks + map_blks + rblks):
+        for i in range(3, m_base + m_pages):
             os.write(fd, data)
     else:
-        for i in range(rbase,rbase+map_blks):
+        for i in list(range(r_base, r_base+r_meta)) + [m_base]:
             os.pwrite(fd, data, i*4096)
-    
+
     os.close(fd)
     
 if __name__ == '__main__':
@@ -115,12 +118,7 @@ if __name__ == '__main__':
             bytes = s.st_size
         pages = bytes // 4096
         print('%d pages' % pages)
-        r_units = int(0.75*pages) // 16
-        r_pages = r_units * 16
-        r_oh = div_round_up(r_units*lsvd.sizeof_obj_offset, 4096)
-        w_pages = pages - r_pages - r_oh - 3     # mkcache subtracts write metadata
-    
-        mkcache(args.device, uuid, write_zeros=False, wblks=w_pages, rblks=r_pages)
+        mkcache(args.device, uuid, write_zeros=False, pages=pages)
     else:
         mkcache(args.device, uuid)
 
@@ -0,0 +1,188 @@
+/*
+ * file:        obj_table.h
+ * description: per-object accounting for the translation layer,
+ *              with utilization buckets for picking GC victims
+ *
+ * author:      Peter Desnoyers, Northeastern University
+ * Copyright 2021, 2022 Peter Desnoyers
+ * license:     GNU LGPL v2.1 or newer
+ *              LGPL-2.1-or-later
+ */
+
+#ifndef OBJ_TABLE_H
+#define OBJ_TABLE_H
+
+#include <deque>
+#include <vector>
+#include <cassert>
+
+#include "objects.h"
+
+/* info on all live data objects - all sizes in sectors. (checkpoints
+ * are tracked in translate_impl::checkpoints instead)
+ */
+struct obj_info {
+    int hdr;			// sectors
+    int data;			// sectors
+    int live;			// sectors
+    enum obj_type type;		// always LSVD_DATA
+};
+
+/* object sequence numbers are allocated densely and objects are
+ * deleted more or less in order, so we keep a deque indexed by
+ * (seq - base) rather than a std::map. Data objects are also kept
+ * in one of n_buckets vectors by utilization (live/data), and
+ * live-sector updates move them between buckets in O(1), so GC
+ * never has to sort the whole table.
+ */
+class obj_table {
+    static const int n_buckets = 64;
+
+    struct entry {
+	obj_info info;
+	bool     valid;
+	bool     busy;		// claimed by a GC worker
+	int      snaps;		// snapshots whose maps point here
+	int      bucket;	// -1 if not in a bucket
+	int      pos;		// index in buckets[bucket]
+    };
+    int base = 0;		// seq of entries[0]
+    int count = 0;
+    std::deque<entry> entries;
+    std::vector<int>  buckets[n_buckets];
+
+    int bucket_of(obj_info &oi) {
+	if (oi.data == 0)
+	    return 0;
+	int b = (int64_t)oi.live * n_buckets / oi.data;
+	return b < n_buckets ? b : n_buckets-1;
+    }
+
+    void bucket_add(int seq, entry &e) {
+	if (e.info.type != LSVD_DATA) {
+	    e.bucket = -1;
+	    return;
+	}
+	e.bucket = bucket_of(e.info);
+	e.pos = buckets[e.bucket].size();
+	buckets[e.bucket].push_back(seq);
+    }
+
+    /* swap with last element, then pop
+     */
+    void bucket_remove(entry &e) {
+	if (e.bucket < 0)
+	    return;
+	auto &v = buckets[e.bucket];
+	int last = v.back();
+	v[e.pos] = last;
+	entries[last - base].pos = e.pos;
+	v.pop_back();
+	e.bucket = -1;
+    }
+
+public:
+    /* range of sequence numbers which may be present
+     */
+    int first(void) { return base; }
+    int limit(void) { return base + entries.size(); }
+    int size(void) { return count; }
+
+    obj_info *find(int seq) {
+	if (seq < base || seq >= limit() || !entries[seq - base].valid)
+	    return NULL;
+	return &entries[seq - base].info;
+    }
+
+    void insert(int seq, obj_info oi) {
+	if (entries.empty())
+	    base = seq;
+	while (seq < base) {
+	    entries.push_front((entry){{}, false, false, 0, -1, 0});
+	    base--;
+	}
+	while (seq >= limit())
+	    entries.push_back((entry){{}, false, false, 0, -1, 0});
+
+	auto &e = entries[seq - base];
+	if (e.valid)
+	    bucket_remove(e);
+	else
+	    count++;
+	e.info = oi;
+	e.valid = true;
+	e.busy = false;
+	e.snaps = 0;
+	bucket_add(seq, e);
+    }
+
+    void erase(int seq) {
+	assert(find(seq) != NULL);
+	auto &e = entries[seq - base];
+	bucket_remove(e);
+	e.valid = false;
+	count--;
+	while (!entries.empty() && !entries.front().valid) {
+	    entries.pop_front();
+	    base++;
+	}
+    }
+
+    /* add (or subtract) live sectors, re-filing the object if
+     * it crosses into a different bucket
+     */
+    void add_live(int seq, int sectors) {
+	assert(find(seq) != NULL);
+	auto &e = entries[seq - base];
+	e.info.live += sectors;
+	assert(e.info.live >= 0);
+	if (e.bucket >= 0 && bucket_of(e.info) != e.bucket) {
+	    bucket_remove(e);
+	    bucket_add(seq, e);
+	}
+    }
+
+    /* objects being cleaned by one GC worker are marked busy, so
+     * that other workers don't pick them as victims
+     */
+    void set_busy(int seq, bool val) {
+	assert(find(seq) != NULL);
+	entries[seq - base].busy = val;
+    }
+    bool busy(int seq) {
+	return find(seq) != NULL && entries[seq - base].busy;
+    }
+
+    /* objects referenced by a snapshot can't be freed, so cleaning
+     * them would just copy their live data; GC leaves them alone
+     * until the last such snapshot is removed.
+     */
+    void snap_ref(int seq, int n) {
+	assert(find(seq) != NULL);
+	entries[seq - base].snaps += n;
+	assert(entries[seq - base].snaps >= 0);
+    }
+    bool pinned(int seq) {
+	return find(seq) != NULL && entries[seq - base].snaps > 0;
+    }
+
+    /* up to @max (seq, total sectors) pairs for non-busy, unpinned
+     * data objects with live/data <= @threshold, roughly in
+     * increasing utilization.
+     */
+    void get_victims(double threshold, int max,
+		     std::vector<std::pair<int,int>> &victims) {
+	for (int b = 0; b < n_buckets && b <= threshold * n_buckets; b++)
+	    for (auto s : buckets[b]) {
+		if ((int)victims.size() >= max)
+		    return;
+		auto &oi = entries[s - base].info;
+		if (oi.live > threshold * oi.data || entries[s - base].busy ||
+		    entries[s - base].snaps > 0)
+		    continue;
+		victims.push_back(std::make_pair(s, oi.hdr + oi.data));
+	    }
+    }
+};
+
+#endif
@@ -9,11 +9,19 @@
 
 #include <sys/uio.h>
 #include <string.h>
+#include <stddef.h>
+#include <assert.h>
 #include <zlib.h>
+#include <algorithm>
+#include <string>
+#include <atomic>
 
 #include "lsvd_types.h"
+#include "extent.h"
 #include "backend.h"
 #include "objects.h"
+#include "crc32c.h"
+#include "misc_cache.h"
 
 extern void do_log(const char *fmt, ...);
 
@@ -38,6 +46,21 @@ fail:
     return NULL;
 }
 
+/* the variable-length fields of an object header have to lie within
+ * the header and hold whole entries
+ */
+static bool field_ok(obj_hdr *h, uint32_t offset, uint32_t len,
+		     size_t size) {
+    size_t hdr_bytes = h->hdr_sectors * 512L;
+    return len % size == 0 && offset <= hdr_bytes &&
+	len <= hdr_bytes - offset;
+}
+
+static bool version_ok(obj_hdr *h) {
+    return h->magic == LSVD_MAGIC && h->version >= 1 &&
+	h->version <= LSVD_OBJ_VERSION;
+}
+
 /* read all info from superblock, returns a vast number of things:
  * [super, vol_size] = f(name, &ckpts, &clones, *&snaps):
  *  - super - pointer to buffer (must be freed)
@@ -51,14 +74,21 @@ object_reader::read_super(const char *name, std::vector<uint32_t> &ckpts,
 			  uuid_t &uuid) {
     char *super_buf = read_object_hdr(name, false);
     auto super_h = (obj_hdr*)super_buf;
+    if (super_buf == NULL)
+	return std::make_pair((char*)NULL,-1);
 
+    super_hdr *super_sh = (super_hdr*)(super_h+1);
     if (super_h->magic != LSVD_MAGIC || super_h->version != 1 ||
-	super_h->type != LSVD_SUPER)
+	super_h->type != LSVD_SUPER ||
+	!field_ok(super_h, super_sh->ckpts_offset, super_sh->ckpts_len,
+		  sizeof(uint32_t)) ||
+	!field_ok(super_h, super_sh->clones_offset, super_sh->clones_len, 1) ||
+	!field_ok(super_h, super_sh->snaps_offset, super_sh->snaps_len, 1)) {
+	free(super_buf);
 	return std::make_pair((char*)NULL,-1);
+    }
     memcpy(uuid, super_h->vol_uuid, sizeof(uuid_t));
 
-    super_hdr *super_sh = (super_hdr*)(super_h+1);
-
     decode_offset_len<uint32_t>(super_buf, super_sh->ckpts_offset,
 				super_sh->ckpts_len, ckpts);
     decode_offset_len_ptr<clone_info>(super_buf, super_sh->clones_offset,
@@ -69,90 +99,221 @@ object_reader::read_super(const char *name, std::vector<uint32_t> &ckpts,
     return std::make_pair(super_buf,super_sh->vol_size * 512);
 }
 
+/* copy out the data header, leaving fields a version 1 object
+ * doesn't have zero, and check its fields. Only the data map is
+ * checked for version 1, since that's all that gets used.
+ */
+static bool get_data_hdr(obj_hdr *h, obj_data_hdr &dh) {
+    dh = {};
+    memcpy(&dh, h+1, h->version == 1 ?
+	   offsetof(obj_data_hdr, data_crcs_offset) : sizeof(dh));
+    return field_ok(h, dh.objs_cleaned_offset, dh.objs_cleaned_len,
+		    sizeof(obj_cleaned)) &&
+	field_ok(h, dh.data_map_offset, dh.data_map_len, sizeof(data_map)) &&
+	field_ok(h, dh.data_crcs_offset, dh.data_crcs_len, 4) &&
+	field_ok(h, dh.data_index_offset, dh.data_index_len,
+		 sizeof(data_index)) &&
+	field_ok(h, dh.dedup_map_offset, dh.dedup_map_len,
+		 sizeof(ckpt_mapentry)) &&
+	field_ok(h, dh.trim_map_offset, dh.trim_map_len, sizeof(data_map));
+}
+
 /* read and decode the header of an object. Copies into arguments,
  * frees all allocated memory
  */
 ssize_t object_reader::read_data_hdr(const char *name, obj_hdr &h,
 				     obj_data_hdr &dh,
 				     std::vector<obj_cleaned> &cleaned,
-				     std::vector<data_map> &dmap) {
+				     std::vector<data_map> &dmap,
+				     std::vector<data_index> *index,
+				     std::vector<ckpt_mapentry> *dedup,
+				     std::vector<data_map> *trims) {
     char *buf = read_object_hdr(name, false);
     if (buf == NULL)
 	return -1;
     auto tmp_h = (obj_hdr*)buf;
-    auto tmp_dh = (obj_data_hdr*)(tmp_h+1);
-    if (tmp_h->type != LSVD_DATA) {
+    if (!version_ok(tmp_h) || tmp_h->type != LSVD_DATA ||
+	!get_data_hdr(tmp_h, dh)) {
+	do_log("%s: bad data header\n", name);
 	free(buf);
 	return -1;
     }
-
     h = *tmp_h;
-    dh = *tmp_dh;
 
-    decode_offset_len<obj_cleaned>(buf, tmp_dh->objs_cleaned_offset,
-				   tmp_dh->objs_cleaned_len, cleaned);
-    decode_offset_len<data_map>(buf, tmp_dh->data_map_offset,
-				tmp_dh->data_map_len, dmap);
+    decode_offset_len<obj_cleaned>(buf, dh.objs_cleaned_offset,
+				   dh.objs_cleaned_len, cleaned);
+    decode_offset_len<data_map>(buf, dh.data_map_offset,
+				dh.data_map_len, dmap);
+    if (index != NULL)
+	decode_offset_len<data_index>(buf, dh.data_index_offset,
+				      dh.data_index_len, *index);
+    if (dedup != NULL)
+	decode_offset_len<ckpt_mapentry>(buf, dh.dedup_map_offset,
+					 dh.dedup_map_len, *dedup);
+    if (trims != NULL)
+	decode_offset_len<data_map>(buf, dh.trim_map_offset,
+				    dh.trim_map_len, *trims);
 
     free(buf);
     return 0;
 }
 
-/* read and decode a checkpoint object identified by sequence number
+/* read and decode a checkpoint object identified by sequence number.
+ * If @_shards is given, a sharded map is returned as a list of shards
+ * instead of being fetched.
  */
 ssize_t object_reader::read_checkpoint(const char *name, uint64_t &cache_seq,
 				       std::vector<uint32_t> &ckpts,
 				       std::vector<ckpt_obj> &objects, 
 				       std::vector<deferred_delete> &deletes,
-				       std::vector<ckpt_mapentry> &dmap) {
+				       std::vector<ckpt_mapentry> &dmap,
+				       std::vector<ckpt_shard> *_shards) {
     char *buf = read_object_hdr(name, false);
     if (buf == NULL) {
 	do_log("buf == NULL\n");
 	return -1;
     }
     auto h = (obj_hdr*)buf;
-    auto ch = (obj_ckpt_hdr*)(h+1);
-    if (h->type != LSVD_CKPT) {
+    if (!version_ok(h) || h->type != LSVD_CKPT) {
 	do_log("%s: WRONG TYPE %d\n", name, h->type);
 	free(buf);
 	return -1;
     }
-    cache_seq = ch->cache_seq;
-    decode_offset_len<uint32_t>(buf, ch->ckpts_offset, ch->ckpts_len, ckpts);
-    decode_offset_len<ckpt_obj>(buf, ch->objs_offset, ch->objs_len, objects);
-    decode_offset_len<deferred_delete>(buf, ch->deletes_offset,
-				       ch->deletes_len, deletes);
-    decode_offset_len<ckpt_mapentry>(buf, ch->map_offset,
-				     ch->map_len, dmap);
-
+    obj_ckpt_hdr ch = {};	// version 1 has no shards
+    memcpy(&ch, h+1, h->version == 1 ?
+	   offsetof(obj_ckpt_hdr, shards_offset) : sizeof(ch));
+    if (!field_ok(h, ch.ckpts_offset, ch.ckpts_len, sizeof(uint32_t)) ||
+	!field_ok(h, ch.objs_offset, ch.objs_len, sizeof(ckpt_obj)) ||
+	!field_ok(h, ch.deletes_offset, ch.deletes_len,
+		  sizeof(deferred_delete)) ||
+	!field_ok(h, ch.map_offset, ch.map_len, sizeof(ckpt_mapentry)) ||
+	!field_ok(h, ch.shards_offset, ch.shards_len, sizeof(ckpt_shard))) {
+	do_log("%s: bad checkpoint header\n", name);
+	free(buf);
+	return -1;
+    }
+    cache_seq = ch.cache_seq;
+    decode_offset_len<uint32_t>(buf, ch.ckpts_offset, ch.ckpts_len, ckpts);
+    decode_offset_len<ckpt_obj>(buf, ch.objs_offset, ch.objs_len, objects);
+    decode_offset_len<deferred_delete>(buf, ch.deletes_offset,
+				       ch.deletes_len, deletes);
+    decode_offset_len<ckpt_mapentry>(buf, ch.map_offset,
+				     ch.map_len, dmap);
+    std::vector<ckpt_shard> shards;
+    decode_offset_len<ckpt_shard>(buf, ch.shards_offset,
+				  ch.shards_len, shards);
     free(buf);
+    if (_shards != NULL)	// caller loads them (lazy open)
+	*_shards = shards;
+    if (shards.size() == 0 || _shards != NULL)
+	return 0;
+
+    /* fetch the shards in parallel, then put them together in order
+     */
+    std::vector<std::vector<ckpt_mapentry>> maps(shards.size());
+    std::atomic<int> failed = 0;
+    parallel_for(shards.size(), ckpt_read_threads, [&](int i) {
+	    std::string shard_name = std::string(name) + "." + std::to_string(i);
+	    uint64_t _seq;
+	    std::vector<uint32_t> _ckpts;
+	    std::vector<ckpt_obj> _objs;
+	    std::vector<deferred_delete> _dels;
+	    if (read_checkpoint(shard_name.c_str(), _seq, _ckpts, _objs,
+				_dels, maps[i]) < 0 ||
+		maps[i].size() != shards[i].n_entries)
+		failed++;
+	});
+    if (failed > 0) {
+	do_log("%s: missing checkpoint shard\n", name);
+	return -1;
+    }
+    for (auto &m : maps)
+	dmap.insert(dmap.end(), m.begin(), m.end());
     return 0;
 }
 
-/* How many bytes will we need for an object header if we 
- * have @n_entries extent entries and @n_ckpts checkpoints. 
+static size_t n_data_crcs(size_t hdr_bytes, size_t data_bytes) {
+    return (hdr_bytes + data_bytes + LSVD_CRC_CHUNK - 1) / LSVD_CRC_CHUNK;
+}
+
+/* size of the data CRC table for an object with @hdr_bytes of header
+ * (not counting the table) and @data_bytes of data. The table
+ * itself can push the header into another chunk, hence the loop.
  */
-size_t obj_hdr_len(int n_entries) {
-    return sizeof(obj_hdr) +
-	sizeof(obj_data_hdr) +
-	n_entries * sizeof(data_map);
+size_t obj_crcs_len(size_t hdr_bytes, size_t data_bytes) {
+    size_t n = 0, n2;
+    while ((n2 = n_data_crcs(round_up(hdr_bytes + 4*n, 512), data_bytes)) > n)
+	n = n2;
+    return 4*n;
 }
 
-/* create header for a data object, returns size in bytes
- * unfortunately we need the length earlier in the code, so
- * we duplicate some of this logic in obj_hdr_len()
+/* Upper bound on the header size for an object with @n_entries
+ * extent entries and @data_bytes of data; it's an upper bound because
+ * each entry can split an earlier one, leaving up to 2 index entries
+ * per write. A header padded out to @hdr_sectors (streaming) may
+ * need another CRC or two. Dedup and trim map entries are smaller
+ * than that, so callers count them in @n_entries.
+ */
+size_t obj_hdr_len(int n_entries, size_t data_bytes, int hdr_sectors) {
+    size_t len = sizeof(obj_hdr) + sizeof(obj_data_hdr) +
+	n_entries * (sizeof(data_map) + 2*sizeof(data_index));
+    if (hdr_sectors > 0)
+	return len + 4 * n_data_crcs(hdr_sectors*512L, data_bytes);
+    return len + obj_crcs_len(len, data_bytes);
+}
+
+/* the live contents of an object, given its data map: later entries
+ * override earlier ones, and offsets are from the start of the data.
+ */
+void make_data_index(std::vector<data_map> *entries,
+		     std::vector<data_index> &index) {
+    extmap::objmap m;
+    int64_t offset = 0;
+    for (auto e : *entries) {
+	m.update(e.lba, e.lba + e.len, (extmap::obj_offset){0, offset});
+	offset += e.len;
+    }
+    for (auto it = m.begin(); it != m.end(); it++) {
+	auto [base, limit, ptr] = it->vals();
+	index.push_back((data_index){(uint64_t)base, (uint64_t)(limit - base),
+				     (uint32_t)ptr.offset});
+    }
+}
+
+/* create header for a data object, returns size in bytes; the
+ * caller can use obj_hdr_len() to size the buffer, and gets the
+ * actual header size from hdr->hdr_sectors.
+ * streamed objects reserve space up front, and pass @_hdr_sectors
+ * if @data is NULL the caller fills in the data CRCs (obj_set_crcs)
+ * and then calls obj_seal_hdr
  */
 size_t make_data_hdr(char *hdr, size_t bytes, uint64_t cache_seq,
 		     std::vector<data_map> *entries, uint32_t seq,
-		     uuid_t *uuid) {
+		     uuid_t *uuid, int _hdr_sectors, const char *data,
+		     std::vector<ckpt_mapentry> *dedup,
+		     std::vector<data_map> *trims) {
     auto h = (obj_hdr*)hdr;
     auto dh = (obj_data_hdr*)(h+1);
+    std::vector<data_index> index;
+    make_data_index(entries, index);
+
     uint32_t o1 = sizeof(*h) + sizeof(*dh),
 	o2 = o1, l2 = entries->size() * sizeof(data_map),
-	hdr_bytes = o2 + l2;
-    uint32_t hdr_sectors = div_round_up(hdr_bytes, 512);
+	o3 = o2 + l2, l3 = index.size() * sizeof(data_index),
+	o5 = o3 + l3, l5 = dedup ? dedup->size() * sizeof(ckpt_mapentry) : 0,
+	o6 = o5 + l5, l6 = trims ? trims->size() * sizeof(data_map) : 0,
+	o4 = o6 + l6;
+    uint32_t l4 = obj_crcs_len(o4, bytes);
+    uint32_t hdr_sectors = div_round_up(o4 + l4, 512);
+    if (_hdr_sectors > 0) {
+	hdr_sectors = _hdr_sectors;
+	l4 = 4 * n_data_crcs(hdr_sectors*512, bytes);
+	assert(o4 + l4 <= hdr_sectors * 512);
+    }
+    uint32_t hdr_bytes = o4 + l4;
 
-    *h = (obj_hdr){.magic = LSVD_MAGIC, .version = 1, .vol_uuid = {0},
+    *h = (obj_hdr){.magic = LSVD_MAGIC, .version = LSVD_OBJ_VERSION,
+		   .vol_uuid = {0},
 		   .type = LSVD_DATA, .seq = seq,
 		   .hdr_sectors = hdr_sectors,
 		   .data_sectors = (uint32_t)(bytes / 512), .crc = 0};
@@ -160,13 +321,97 @@ size_t make_data_hdr(char *hdr, size_t bytes, uint64_t cache_seq,
 
     *dh = (obj_data_hdr){.cache_seq = cache_seq,
 			 .objs_cleaned_offset = 0, . objs_cleaned_len = 0,
-			 .data_map_offset = o2, .data_map_len = l2};
+			 .data_map_offset = o2, .data_map_len = l2,
+			 .data_crcs_offset = o4, .data_crcs_len = l4,
+			 .data_index_offset = o3, .data_index_len = l3,
+			 .dedup_map_offset = o5, .dedup_map_len = l5,
+			 .trim_map_offset = o6, .trim_map_len = l6};
 
     auto dm = (data_map*)(dh+1);
     for (auto e : *entries)
 	*dm++ = e;
-    auto ptr = (const unsigned char *)hdr;
-    h->crc = (uint32_t)crc32(0, ptr, hdr_sectors*512);
+    auto di = (data_index*)dm;
+    for (auto e : index)
+	*di++ = e;
+    auto dd = (ckpt_mapentry*)di;
+    if (dedup != NULL)
+	for (auto e : *dedup)
+	    *dd++ = e;
+    auto dt = (data_map*)dd;
+    if (trims != NULL)
+	for (auto e : *trims)
+	    *dt++ = e;
+    memset(dt, 0, l4);
+
+    if (data != NULL) {
+	obj_set_crcs(hdr, data, hdr_sectors*512, bytes);
+	obj_seal_hdr(hdr);
+    }
+    return hdr_bytes;
+}
+
+/* chunk @i of the object header @h covers object bytes [base,limit),
+ * which is empty if it's all header
+ */
+static std::pair<size_t,size_t> crc_chunk(obj_hdr *h, size_t i) {
+    size_t data_start = h->hdr_sectors * 512L,
+	obj_end = data_start + h->data_sectors * 512L;
+    size_t base = std::max(i * LSVD_CRC_CHUNK, data_start),
+	limit = std::min((i+1) * LSVD_CRC_CHUNK, obj_end);
+    return std::make_pair(base, std::max(base, limit));
+}
 
-    return (char*)dm - (char*)hdr;
+/* fill in the data CRCs for object bytes [obj_offset, obj_offset+len),
+ * which are in @buf. The range has to cover every chunk it touches,
+ * not counting header or the end of the object.
+ */
+void obj_set_crcs(char *hdr, const char *buf, size_t obj_offset,
+		  size_t len) {
+    auto h = (obj_hdr*)hdr;
+    auto dh = (obj_data_hdr*)(h+1);
+    auto crcs = (uint32_t*)(hdr + dh->data_crcs_offset);
+    size_t n = dh->data_crcs_len / 4;
+
+    for (size_t i = obj_offset / LSVD_CRC_CHUNK;
+	 i < n && i * LSVD_CRC_CHUNK < obj_offset + len; i++) {
+	auto [base, limit] = crc_chunk(h, i);
+	assert(base >= obj_offset && limit <= obj_offset + len);
+	crcs[i] = crc32c(0, buf + (base - obj_offset), limit - base);
+    }
+}
+
+/* header CRC (zlib) goes last, after the data CRCs are filled in
+ */
+void obj_seal_hdr(char *hdr) {
+    auto h = (obj_hdr*)hdr;
+    h->crc = 0;
+    h->crc = (uint32_t)crc32(0, (const unsigned char*)hdr,
+			     h->hdr_sectors * 512);
+}
+
+/* check the data CRCs for any chunks entirely within @buf, which holds
+ * object bytes [obj_offset, obj_offset+len). Returns the number of
+ * chunks which don't match.
+ */
+int obj_check_crcs(const char *hdr, const char *buf, size_t obj_offset,
+		   size_t len) {
+    auto h = (obj_hdr*)hdr;
+    auto dh = (obj_data_hdr*)(h+1);
+    if (h->type != LSVD_DATA || h->version < 2)	// v1: no CRCs
+	return 0;
+    if (!field_ok(h, dh->data_crcs_offset, dh->data_crcs_len, 4))
+	return 1;
+    auto crcs = (const uint32_t*)(hdr + dh->data_crcs_offset);
+    size_t n = dh->data_crcs_len / 4;
+
+    int bad = 0;
+    for (size_t i = obj_offset / LSVD_CRC_CHUNK;
+	 i < n && i * LSVD_CRC_CHUNK < obj_offset + len; i++) {
+	auto [base, limit] = crc_chunk(h, i);
+	if (base == limit || base < obj_offset || limit > obj_offset + len)
+	    continue;
+	if (crc32c(0, buf + (base - obj_offset), limit - base) != crcs[i])
+	    bad++;
+    }
+    return bad;
 }
@@ -31,11 +31,19 @@ enum obj_type {
     LSVD_CKPT = 3
 };
 
+/* data and checkpoint headers have grown fields since version 1
+ * (data CRCs, index, dedup and trim maps; checkpoint shards), which
+ * are appended to obj_data_hdr and obj_ckpt_hdr. Version 1 objects
+ * are decoded with the new fields zeroed. The superblock is still
+ * version 1.
+ */
+enum { LSVD_OBJ_VERSION = 2 };
+
 // hdr :	header structure used to contain data for separate objects in translation and write cache layers
 //		of the LSVD system
 struct obj_hdr {
     uint32_t magic;
-    uint32_t version;		// 1
+    uint32_t version;		// 1 (super), LSVD_OBJ_VERSION
     uuid_t   vol_uuid;
     uint32_t type;
     uint32_t seq;		// same as in name
@@ -85,8 +93,23 @@ struct obj_data_hdr {
     uint32_t objs_cleaned_len;
     uint32_t data_map_offset;
     uint32_t data_map_len;
+    uint32_t data_crcs_offset;	// uint32_t[], see below
+    uint32_t data_crcs_len;
+    uint32_t data_index_offset;	// data_index[], see below
+    uint32_t data_index_len;
+    uint32_t dedup_map_offset;	// ckpt_mapentry[], see below
+    uint32_t dedup_map_len;
+    uint32_t trim_map_offset;	// data_map[], see below
+    uint32_t trim_map_len;
 } __attribute__((packed));
 
+/* data CRCs: one CRC32C for each LSVD_CRC_CHUNK of the object,
+ * counting from the start of the object (so they line up with read
+ * cache blocks), over the part of the chunk past the header. Objects
+ * without them have data_crcs_len = 0.
+ */
+enum { LSVD_CRC_CHUNK = 64*1024 };
+
 struct obj_cleaned {
     uint32_t seq;
     uint32_t was_deleted;
@@ -99,6 +122,33 @@ struct data_map {
     uint64_t len : 28;
 } __attribute__((packed));
 
+/* the data map is in write order, and may include data overwritten
+ * later in the same object. The data index is what's left: sorted by
+ * LBA, non-overlapping, with explicit offsets (sectors from the start
+ * of the data, not the object), so object contents can be looked up
+ * without the global map or decoding the whole data map.
+ */
+struct data_index {
+    uint64_t lba : 36;
+    uint64_t len : 28;
+    uint32_t offset;
+} __attribute__((packed));
+
+/* first entry in a sorted data index which ends after @lba
+ */
+static inline const data_index *data_index_find(const data_index *begin,
+						const data_index *end,
+						int64_t lba) {
+    while (begin < end) {
+	auto mid = begin + (end - begin) / 2;
+	if ((int64_t)(mid->lba + mid->len) <= lba)
+	    begin = mid + 1;
+	else
+	    end = mid;
+    }
+    return begin;
+}
+
 struct obj_ckpt_hdr {
     uint64_t cache_seq;         // from last data object
     uint32_t ckpts_offset;	// list includes self (TODO - not needed?)
@@ -109,6 +159,19 @@ struct obj_ckpt_hdr {
     uint32_t deletes_len;
     uint32_t map_offset;        // ckpt_mapentry[]
     uint32_t map_len;
+    uint32_t shards_offset;	// ckpt_shard[], if map is sharded
+    uint32_t shards_len;
+} __attribute__((packed));
+
+/* large maps are split by LBA range into shard objects, named
+ * <prefix>.<ckpt seq>.<n>, which are checkpoint objects holding only
+ * their part of the map. The checkpoint itself (the manifest) lists
+ * them in LBA order and has no map entries of its own.
+ */
+struct ckpt_shard {
+    int64_t  base;		// LBA range
+    int64_t  limit;
+    uint32_t n_entries;
 } __attribute__((packed));
 
 struct ckpt_obj {
@@ -130,10 +193,20 @@ struct ckpt_mapentry {
     int32_t offset;
 } __attribute__((packed));
 
+/* dedup map (inline dedup): LBA ranges written to this object whose
+ * data was already in an earlier object, as ckpt_mapentry. They're
+ * applied to the map after the object's own data.
+ */
+
+/* trim map (discard): LBA ranges unmapped since the last object, as
+ * data_map. Applied last, after the data and dedup maps.
+ */
+
 class backend;
 
 class object_reader {
     backend *objstore;
+    static const int ckpt_read_threads = 8; // for checkpoint shards
 
 public:
     object_reader(backend *be) : objstore(be) {}
@@ -148,19 +221,36 @@ public:
 
     ssize_t read_data_hdr(const char *name, obj_hdr &h, obj_data_hdr &dh,
 			  std::vector<obj_cleaned> &cleaned,
-			  std::vector<data_map> &dmap);
+			  std::vector<data_map> &dmap,
+			  std::vector<data_index> *index = NULL,
+			  std::vector<ckpt_mapentry> *dedup = NULL,
+			  std::vector<data_map> *trims = NULL);
 
     ssize_t read_checkpoint(const char *name, uint64_t &cache_seq,
 			    std::vector<uint32_t> &ckpts,
 			    std::vector<ckpt_obj> &objects, 
 			    std::vector<deferred_delete> &deletes,
-			    std::vector<ckpt_mapentry> &dmap);
+			    std::vector<ckpt_mapentry> &dmap,
+			    std::vector<ckpt_shard> *shards = NULL);
 };
 
-extern size_t obj_hdr_len(int n_entries);
+extern size_t obj_hdr_len(int n_entries, size_t data_bytes,
+                          int hdr_sectors = 0);
+extern size_t obj_crcs_len(size_t hdr_bytes, size_t data_bytes);
+extern void make_data_index(std::vector<data_map> *entries,
+                            std::vector<data_index> &index);
 
 extern size_t make_data_hdr(char *hdr, size_t bytes, uint64_t cache_seq,
                             std::vector<data_map> *entries,
-                            uint32_t seq, uuid_t *uuid);
+                            uint32_t seq, uuid_t *uuid,
+                            int hdr_sectors = 0, const char *data = NULL,
+                            std::vector<ckpt_mapentry> *dedup = NULL,
+                            std::vector<data_map> *trims = NULL);
+
+extern void obj_set_crcs(char *hdr, const char *buf, size_t obj_offset,
+                         size_t len);
+extern void obj_seal_hdr(char *hdr);
+extern int obj_check_crcs(const char *hdr, const char *buf,
+                          size_t obj_offset, size_t len);
 
 #endif
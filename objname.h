@@ -17,9 +17,13 @@ public:
     objname(const char *prefix, uint32_t seq) {
         init(prefix, seq);
     }
+    objname(const char *prefix, uint32_t seq, int shard) { // checkpoints
+        init(prefix, seq);
+        sprintf(buf + strlen(buf), ".%d", shard);
+    }
     void init(const char *prefix, uint32_t seq) {
         size_t len = strlen(prefix);
-        assert(len + 9 < sizeof(buf));
+        assert(len + 9 + 12 < sizeof(buf));
         memcpy(buf, prefix, len);
         sprintf(buf + len, ".%08x", seq);
     }
@@ -45,12 +45,24 @@ def fmt_obj(objs):
         l.append("[obj=%d hdr=%d data=%d live=%d]" % (o.seq, o.hdr_sectors, o.data_sectors, o.live_sectors))
     return l
 
+def fmt_deletes(dels):
+    l = []
+    for d in dels:
+        l.append("[%d @%d]" % (d.seq, d.time))
+    return l
+
 def fmt_data_map(maps):
     l = []
     for m in maps:
         l.append("[%d %d]" % (m.lba, m.len))
     return l
 
+def fmt_data_index(idx):
+    l = []
+    for m in idx:
+        l.append("[%d %d @%d]" % (m.lba, m.len, m.offset))
+    return l
+
 def fmt_ckpt_map(maps):
     l = []
     for m in maps:
@@ -64,6 +76,26 @@ def read_ckpts(buf, base, bytes):
     ckpts = (c_int * n).from_buffer(buf[base:base+bytes])
     return [_ for _ in ckpts]
 
+def read_clones(buf, base, nbytes):
+    clones = []
+    o = base
+    while o < base+nbytes:
+        c = lsvd.clone.from_buffer(buf[o:o+lsvd.sizeof_clone])
+        name = buf[o+lsvd.sizeof_clone:o+lsvd.sizeof_clone+c.name_len]
+        clones.append((c.sequence, name.decode('utf-8')))
+        o += lsvd.sizeof_clone + c.name_len
+    return clones
+
+def read_snaps(buf, base, nbytes):
+    snaps = []
+    o = base
+    while o < base+nbytes:
+        s = lsvd.snap.from_buffer(buf[o:o+lsvd.sizeof_snap])
+        name = buf[o+lsvd.sizeof_snap:o+lsvd.sizeof_snap+s.name_len]
+        snaps.append((s.seq, name.decode('utf-8')))
+        o += lsvd.sizeof_snap + s.name_len
+    return snaps
+
 import zlib
 print('crc:          %08x' % zlib.crc32(obj))
 h = lsvd.hdr.from_buffer(bytearray(obj[0:l1]))
@@ -89,12 +121,14 @@ if h.type == lsvd.LSVD_SUPER:
     if sh.ckpts_offset > sh.ckpts_len:
         ckpts = read_ckpts(bytearray(obj), sh.ckpts_offset, sh.ckpts_len)
         print('ckpts:         ', ','.join(map(lambda x: '%08x' % x, ckpts)))
-    print('clones:        ', '[tbd]')
-    print('snaps:         ', '[tbd]')
+    clones = read_clones(bytearray(obj), sh.clones_offset, sh.clones_len)
+    print('clones:        ', ','.join(map(lambda x: '%s<=%08x' % (x[1], x[0]), clones)))
+    snaps = read_snaps(bytearray(obj), sh.snaps_offset, sh.snaps_len)
+    print('snaps:         ', ','.join(map(lambda x: '%s@%08x' % (x[1], x[0]), snaps)))
     
 elif h.type == lsvd.LSVD_DATA:
-    o3 = o2+lsvd.sizeof_data_hdr
-    dh = lsvd.data_hdr.from_buffer(bytearray(obj[o2:o3]))
+    n = lsvd.sizeof_data_hdr_v1 if h.version == 1 else lsvd.sizeof_data_hdr
+    dh = lsvd.data_hdr.from_buffer(bytearray(obj[o2:o2+n]).ljust(lsvd.sizeof_data_hdr, b'\0'))
         
     o5 = dh.objs_cleaned_offset; l5 = dh.objs_cleaned_len
     objs = (lsvd.obj_cleaned * (l5//lsvd.sizeof_obj_cleaned)).from_buffer(bytearray(obj[o5:o5+l5]))
@@ -102,6 +136,18 @@ elif h.type == lsvd.LSVD_DATA:
     o6 = dh.map_offset; l6 = dh.map_len
     maps = (lsvd.data_map * (l6//lsvd.sizeof_data_map)).from_buffer(bytearray(obj[o6:o6+l6]))
 
+    o7 = dh.crcs_offset; l7 = dh.crcs_len
+    crcs = (c_uint * (l7//4)).from_buffer(bytearray(obj[o7:o7+l7]))
+
+    o8 = dh.index_offset; l8 = dh.index_len
+    idx = (lsvd.data_index * (l8//lsvd.sizeof_data_index)).from_buffer(bytearray(obj[o8:o8+l8]))
+
+    o9 = dh.dedup_offset; l9 = dh.dedup_len
+    dedup = (lsvd.ckpt_mapentry * (l9//lsvd.sizeof_ckpt_mapentry)).from_buffer(bytearray(obj[o9:o9+l9]))
+
+    o10 = dh.trim_offset; l10 = dh.trim_len
+    trims = (lsvd.data_map * (l10//lsvd.sizeof_data_map)).from_buffer(bytearray(obj[o10:o10+l10]))
+
     print('name:     ', args.object)
     print('magic:    ', 'OK' if h.magic == lsvd.LSVD_MAGIC else '**BAD**')
     print('version:  ', h.version)
@@ -117,10 +163,14 @@ elif h.type == lsvd.LSVD_DATA:
             print(' ' + '\n '.join(fmt_data_map(maps)))
     else:
         print('map:      ', '%d+%d' % (dh.map_offset,dh.map_len), ':', ', '.join(fmt_data_map(maps)))
+    print('index:    ', '%d+%d' % (dh.index_offset,dh.index_len), ':', ', '.join(fmt_data_index(idx)))
+    print('dedup:    ', '%d+%d' % (dh.dedup_offset,dh.dedup_len), ':', ', '.join(fmt_ckpt_map(dedup)))
+    print('trim:     ', '%d+%d' % (dh.trim_offset,dh.trim_len), ':', ', '.join(fmt_data_map(trims)))
+    print('data crcs:', '%d+%d' % (dh.crcs_offset,dh.crcs_len), ':', ' '.join(map(lambda x: '%08x' % x, crcs)))
     
 elif h.type == lsvd.LSVD_CKPT:
-    o3 = o2+lsvd.sizeof_ckpt_hdr
-    ch = lsvd.ckpt_hdr.from_buffer(bytearray(obj[o2:o3]))
+    n = lsvd.sizeof_ckpt_hdr_v1 if h.version == 1 else lsvd.sizeof_ckpt_hdr
+    ch = lsvd.ckpt_hdr.from_buffer(bytearray(obj[o2:o2+n]).ljust(lsvd.sizeof_ckpt_hdr, b'\0'))
 
     o4 = ch.ckpts_offset; l4 = ch.ckpts_len
     ckpts = (c_uint * (l4//4)).from_buffer(bytearray(obj[o4:o4+l4]))
@@ -136,8 +186,12 @@ elif h.type == lsvd.LSVD_CKPT:
         else:
             objs_txt = ', '.join(fmt_obj(objs))
 
-#    o6 = ch.deletes_offset; l6 = ch.deletes_len
-#    dels = (lsvd.deferred_delete * (l5//lsvd.sizeof_deferred_delete)).from_buffer(bytearray(obj[o6:o6+l6]))
+    o6 = ch.deletes_offset; l6 = ch.deletes_len
+    if o6+l6 > len(obj):
+        dels_txt = 'OBJECT TOO SHORT (%d bytes)' % len(obj)
+    else:
+        dels = (lsvd.deferred_delete * (l6//lsvd.sizeof_deferred_delete)).from_buffer(bytearray(obj[o6:o6+l6]))
+        dels_txt = ', '.join(fmt_deletes(dels))
 
     o7 = ch.map_offset; l7 = ch.map_len
     if o7+l7 > len(obj):
@@ -161,7 +215,12 @@ elif h.type == lsvd.LSVD_CKPT:
     print('cache_seq:', ch.cache_seq)
     print('ckpts:    ', ch.ckpts_offset, ':', ', '.join(fmt_ckpt(ckpts)))
     print('objs:     ', ch.objs_offset, ':', objs_txt)
+    print('deletes:  ', ch.deletes_offset, ':', dels_txt)
     print('map:      ', ch.map_offset, ':', map_txt)
+    o8 = ch.shards_offset; l8 = ch.shards_len
+    if l8 > 0:
+        shards = (lsvd.ckpt_shard * (l8//lsvd.sizeof_ckpt_shard)).from_buffer(bytearray(obj[o8:o8+l8]))
+        print('shards:   ', o8, ':', ', '.join(['%d:[%d,%d) %d' % (i, s.base, s.limit, s.n_entries) for i,s in enumerate(shards)]))
     
 else:
     print("invalid type:", h.type)
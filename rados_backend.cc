@@ -48,6 +48,8 @@ public:
     /* async I/O
      */
     request *make_write_req(const char *name, iovec *iov, int iovcnt);
+    request *make_write_req(const char *name, size_t offset,
+                            iovec *iov, int iovcnt);
     request *make_read_req(const char *name, size_t offset,
                            iovec *iov, int iovcnt);
     request *make_read_req(const char *name, size_t offset,
@@ -166,6 +168,7 @@ class rados_be_request : public request {
 
 public:
     enum lsvd_op   op;
+    bool           full = true; // false for partial writes
 
     rados_be_request(enum lsvd_op op_, char *obj_name,
 		     iovec *iov, int niov, size_t offset_,
@@ -208,8 +211,10 @@ public:
 	rados_aio_create_completion(this, rados_be_notify, NULL, &c);
 	if (op == OP_READ)
 	    rados_aio_read(io_ctx, oid, c, _buf, _iovs.bytes(), offset);
-	else
+	else if (full)
 	    rados_aio_write_full(io_ctx, oid, c, _buf, _iovs.bytes());
+	else
+	    rados_aio_write(io_ctx, oid, c, _buf, _iovs.bytes(), offset);
     }
 
     void release() {}
@@ -223,6 +228,15 @@ request *rados_backend::make_write_req(const char *name, iovec *iov,
     return new rados_be_request(OP_WRITE, oid, iov, iovcnt, 0, io_ctx);
 }
 
+request *rados_backend::make_write_req(const char *name, size_t offset,
+				       iovec *iov, int iovcnt) {
+    auto oid = pool_init(name);
+    auto req = new rados_be_request(OP_WRITE, oid, iov, iovcnt, offset,
+				    io_ctx);
+    req->full = false;
+    return req;
+}
+
 request *rados_backend::make_read_req(const char *name, size_t offset,
 				      iovec *iov, int iovcnt) {
     auto oid = pool_init(name);
@@ -5,6 +5,9 @@
  *                       * 1. indexed by obj/offset[*], not LBA
  *                       * 2. stores aligned 64KB blocks
  *                       * [*] offset is in units of 64KB blocks
+ *              it's per image (cache file named by volume uuid), so
+ *              clones don't share cached base objects with each other
+ *              or with their parent.
  * author:      Peter Desnoyers, Northeastern University
  *              Copyright 2021, 2022 Peter Desnoyers
  * license:     GNU LGPL v2.1 or newer
@@ -14,6 +17,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 
 #include <shared_mutex>
 #include <mutex>
@@ -378,8 +382,12 @@ class rcache_req : public request {
     off_t nvme_offset;
     off_t buf_offset;
     char *_buf = NULL;
+    int   retries = 0;		// backend reads failing CRC check
+    int   err = 0;
 
     std::mutex m;
+
+    void fail_block(void);
     
 public:
     extmap::obj_offset _oo;
@@ -391,10 +399,41 @@ public:
     void run(request *parent);
     void notify(request *child);
     void release();
+    int error() { return err; }
 
     void wait() {}
 };    
 
+/* the cache block read from the backend was corrupt: give up the
+ * cache block and its buffer (so take it out of buf_loc too) and fail
+ * this request, and any waiting on it, with EIO
+ */
+void rcache_req::fail_block(void) {
+    std::unique_lock lk(rci->m);
+    std::vector<request*>
+	v(std::make_move_iterator(rci->pending[n].begin()),
+	  std::make_move_iterator(rci->pending[n].end()));
+    rci->pending[n].erase(rci->pending[n].begin(), rci->pending[n].end());
+    rci->map.erase(unit);
+    rci->in_use[n]--;
+    rci->free_blks.push_back(n);
+    rci->outstanding_writes--;
+    std::queue<int> q;
+    for (; !rci->buf_loc.empty(); rci->buf_loc.pop())
+	if (rci->buf_loc.front() != n)
+	    q.push(rci->buf_loc.front());
+    rci->buf_loc.swap(q);
+    lk.unlock();
+
+    free(_buf);
+    _buf = NULL;
+    err = -EIO;
+    for (auto p : v) {
+	((rcache_req*)p)->err = -EIO;
+	p->notify(NULL);
+    }
+}
+
 void rcache_req::release() {
     released = true;
     if (state == RCACHE_DONE)
@@ -420,13 +459,35 @@ void rcache_req::notify(request *child) {
     /* completion of a pending prior read
      */
     else if (state == RCACHE_QUEUED) {
-	iovs.copy_in(rci->buffer[n] + blk_offset*512);
+	if (err == 0)		// else see fail_block
+	    iovs.copy_in(rci->buffer[n] + blk_offset*512);
 	notify_parent = true;
 	next_state = RCACHE_DONE;
 	do_log("q %d %d %d.%d\n", n, sector, _oo.obj, _oo.offset);
     }
     /* cache block read completion
      */
+    else if (state == RCACHE_BACKEND_WAIT &&
+	     !rci->be->verify_read(unit.obj,
+				   unit.offset * rci->unit_sectors * 512L,
+				   _buf, rci->unit_sectors * 512L,
+				   /*always=*/ retries > 0)) {
+	/* don't cache corrupt data. Retry in case it got damaged on
+	 * the way, then give up
+	 */
+	if (retries++ < 2) {
+	    objname name(rci->be->prefix(unit.obj), unit.obj);
+	    sub_req = rci->io->make_read_req(name.c_str(),
+					     unit.offset * rci->unit_sectors * 512L,
+					     _buf, rci->unit_sectors * 512L);
+	    sub_req->run(this);
+	}
+	else {
+	    fail_block();
+	    notify_parent = true;
+	    next_state = RCACHE_DONE;
+	}
+    }
     else if (state == RCACHE_BACKEND_WAIT) {
 	iovs.copy_in(_buf + buf_offset);
 
@@ -482,7 +543,16 @@ void rcache_req::run(request *parent_) {
     }
     else if (state == RCACHE_PENDING_QUEUE) {
 	std::unique_lock lk(rci->m);
-	if (rci->buffer[n] != NULL) {
+	auto it = rci->map.find(unit);
+	if (it == rci->map.end() || it->second != n) {
+	    lk.unlock();	// failed since async_readv, see fail_block
+	    err = -EIO;
+	    parent->notify(this);
+	    state = RCACHE_DONE;
+	    if (released)
+		delete this;
+	}
+	else if (rci->buffer[n] != NULL) {
 	    iovs.copy_in(rci->buffer[n] + blk_offset*512);
 	    parent->notify(this);
 	    state = RCACHE_DONE;
@@ -515,7 +585,8 @@ read_cache_impl::async_readv(size_t offset, smartiov *iov) {
     sector_t base = offset/512, sectors = len/512, limit = base+sectors;
     sector_t read_sectors = -1, skip_sectors = -1;
     extmap::obj_offset oo = {0, 0};
-    
+
+    be->load_map(offset, len);	// lazy open
     std::shared_lock lk(*obj_lock);
     auto it = obj_map->lookup(base);
     if (it == obj_map->end() || it->base() >= limit) {
@@ -532,12 +603,20 @@ read_cache_impl::async_readv(size_t offset, smartiov *iov) {
 
     if (read_sectors == 0)
 	return std::make_tuple(skip_sectors*512L, 0, (request*)NULL);
+    be->note_read(512L*(base + skip_sectors), 512L*read_sectors);
     
-    /* handle the small probability that it's for an object
-     * currently being GC'ed
+    /* the object may not be on the backend yet. If it's a data
+     * object its contents are still in memory; otherwise (GC) we
+     * have to wait, but that's rare.
      */
-    if (!be->check_object_ready(oo.obj))
+    if (!be->check_object_ready(oo.obj)) {
+	auto slice = iov->slice(skip_sectors*512L,
+				(skip_sectors + read_sectors)*512L);
+	if (be->read_buffered(512L*(base + skip_sectors), &slice))
+	    return std::make_tuple(skip_sectors*512L, read_sectors*512L,
+				   (request*)NULL);
 	be->wait_object_ready(oo.obj);
+    }
 
     auto r = new rcache_req(this);
     r->sector = base + skip_sectors; // debug
@@ -658,7 +737,7 @@ read_cache_impl::async_readv(size_t offset, smartiov *iov) {
 	r->iovs = iov->slice(skip_len, skip_len+read_len);
 	//do_log("%ld+%ld fetch[%d]\n", (offset+skip_len)/512, read_len/512, n);
 	
-	objname name(be->prefix(), unit.obj);
+	objname name(be->prefix(unit.obj), unit.obj);
 	r->sub_req = io->make_read_req(name.c_str(), 512L*blk_base,
 				       _buf, 512L*unit_sectors);
 	do_log("f %d %d %d.%d\n", n, r->sector, unit.obj, blk_base+blk_offset);
@@ -669,7 +748,7 @@ read_cache_impl::async_readv(size_t offset, smartiov *iov) {
 	hit_stats.backend += read_sectors;
 	lk2.unlock();
 
-	objname name(be->prefix(), oo.obj);
+	objname name(be->prefix(oo.obj), oo.obj);
 	auto tmp = iov->slice(skip_len, skip_len + read_len);
 	auto [_iov, _niov] = tmp.c_iov();
 	r->sub_req = io->make_read_req(name.c_str(), 512L*oo.offset,
@@ -14,6 +14,7 @@
 /* generic interface for requests.
  *  - run(parent): begin execution
  *  - notify(rv): notification of completion
+ *  - error(): 0 or -errno, checked by parent on notification
  *  - TODO: wait(): wait for completion
  */
 class request {
@@ -22,6 +23,7 @@ public:
     virtual void run(request *parent) = 0;
     virtual void notify(request *child) = 0;
     virtual void release() = 0;
+    virtual int error() { return 0; }
     virtual ~request(){}
     request() {}
 };
@@ -14,6 +14,7 @@
 
 #include <uuid/uuid.h>
 #include <zlib.h>
+#include <openssl/sha.h>
 
 #include <vector>
 #include <mutex>
@@ -23,6 +24,9 @@
 
 #include <stack>
 #include <map>
+#include <set>
+#include <deque>
+#include <unordered_map>
 
 #include <algorithm>
 
@@ -32,13 +36,18 @@
 #include "lsvd_types.h"
 #include "request.h"
 #include "objects.h"
+#include "crc32c.h"
 #include "objname.h"
 #include "config.h"
 #include "translate.h"
+#include "obj_table.h"
+#include "compln_tracker.h"
 
 #include "backend.h"
 #include "smartiov.h"
 #include "misc_cache.h"
+#include "nvme.h"
+#include "journal.h"
 
 
 void do_log(const char*, ...);
@@ -46,6 +55,86 @@ void fp_log(const char*, ...);
 
 /* ----------- Object translation layer -------------- */
 
+/* a data object uploaded in parts while its batch is still filling.
+ * The header is written after all the parts are on the backend, so
+ * a partly-written object never has a valid header.
+ */
+class stream_req : public trivial_request {
+    std::mutex m;
+    int        in_flight = 0;
+    request   *hdr_req = NULL;	// set when the batch is sealed
+    request   *parent = NULL;
+
+    void write_hdr(void) {
+	auto req = hdr_req;
+	auto p = parent;
+	delete this;
+	req->run(p);
+    }
+    
+public:
+    stream_req() {}
+    ~stream_req() {}
+
+    void add_part(request *part) {
+	std::unique_lock lk(m);
+	in_flight++;
+	lk.unlock();
+	part->run(this);
+    }
+
+    /* batch is sealed and the last part sent: write @hdr once
+     * they're done, and notify @parent when that completes
+     */
+    void finish(request *hdr, request *parent_) {
+	std::unique_lock lk(m);
+	hdr_req = hdr;
+	parent = parent_;
+	if (in_flight > 0)
+	    return;
+	lk.unlock();
+	write_hdr();
+    }
+
+    void notify(request *child) {
+	if (child)
+	    child->release();
+	std::unique_lock lk(m);
+	if (--in_flight > 0 || hdr_req == NULL)
+	    return;
+	lk.unlock();
+	write_hdr();
+    }
+};
+
+/* inline dedup: the first 128 bits of the SHA-256 of a 4KB block.
+ * A false match would silently return the wrong data, so this has
+ * to be a cryptographic hash; SHA-256 uses the SHA extensions where
+ * the CPU has them.
+ */
+struct fingerprint {
+    uint64_t a, b;
+    bool operator==(const fingerprint &x) const {
+	return a == x.a && b == x.b;
+    }
+};
+struct fingerprint_hash {
+    size_t operator()(const fingerprint &fp) const { return fp.a; }
+};
+static const int dedup_block = 4096;
+
+/* trim map entries are data_map, with a 28-bit length
+ */
+static const int64_t max_trim_len = 1 << 27;
+
+static fingerprint block_fingerprint(const char *buf) {
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char*)buf, dedup_block, md);
+    fingerprint fp;
+    memcpy(&fp, md, sizeof(fp));
+    return fp;
+}
+
 class batch {
 public:
     std::vector<data_map> entries;
@@ -54,23 +143,226 @@ public:
     size_t max;			// done when len hits here
     int    seq = 0;		// sequence number for backend
     uint64_t cache_seq = 0;
+    std::chrono::system_clock::time_point first_write; // for flush deadline
+
+    /* streaming upload (cfg->stream_part): the start of buf is
+     * written while the rest fills, after a fixed-size header
+     */
+    stream_req *stream = NULL;
+    size_t sent = 0;		// bytes of buf already sent
+    int    hdr_sectors = 0;	// reserved for header if streaming
+
+    /* journal-reference batches (cfg->xlate_refs) keep the SSD
+     * offset of each entry instead of a copy. refs[i] is -1 if
+     * entry i was copied into buf (e.g. journal replay), and buf
+     * is only allocated if that happens.
+     */
+    std::vector<int64_t> refs;
+    uint64_t pin_seq = 0;	// oldest journal record we need
+
+    /* inline dedup (cfg->dedup_blocks): LBA ranges that point at
+     * copies already in other objects, the objects they point to
+     * (pinned until the batch is in the map), and fingerprints of
+     * the blocks we do upload, by offset in buf (sectors)
+     */
+    extmap::objmap dups;
+    std::vector<int> dup_objs;
+    std::vector<std::pair<fingerprint,int>> fps;
+
+    /* discards (translate::trim) not overwritten since, as LBA ranges
+     * mapped to themselves. Applied after everything else.
+     */
+    extmap::cachemap2 trims;
 
-    batch(size_t bytes){
-	buf = (char*)malloc(bytes);
+    batch(size_t bytes, bool lazy = false){
+	if (!lazy)
+	    buf = (char*)malloc(bytes);
 	max = bytes;
     }
     ~batch(){
 	free(buf);
     }
+    bool empty(void) {
+	return len == 0 && dups.size() == 0 && trims.size() == 0;
+    }
     void append(uint64_t lba, smartiov *iov) {
 	auto bytes = iov->bytes();
+	if (buf == NULL)
+	    buf = (char*)malloc(max);
+	dups.trim(lba, lba + bytes/512);
+	trims.trim(lba, lba + bytes/512);
 	entries.push_back((data_map){lba, bytes/512});
+	refs.push_back(-1);
 	char *ptr = buf + len;
 	iov->copy_out(ptr);
 	len += bytes;
     }
+    void append_ref(uint64_t lba, size_t bytes, size_t j_offset) {
+	dups.trim(lba, lba + bytes/512);
+	trims.trim(lba, lba + bytes/512);
+	entries.push_back((data_map){lba, bytes/512});
+	refs.push_back(j_offset);
+	len += bytes;
+    }
+};
+
+
+/* uploads a batch holding journal references. The data is read
+ * back from the write cache SSD a part at a time and written to
+ * the backend at its place in the object, with at most ref_depth
+ * parts in memory. Parts end on LSVD_CRC_CHUNK boundaries in the
+ * object, so each one fills in its own data CRCs; as with
+ * streaming, the header goes last.
+ */
+class ref_upload;
+class ref_part : public trivial_request {
+    ref_upload *up;
+    std::atomic<int> n_reads = 1; // held until all reads are sent
+    bool writing = false;
+public:
+    char  *buf;
+    size_t len;
+    size_t obj_offset;		// in object, including header
+    std::vector<std::tuple<char*,size_t,size_t>> reads; // ptr, len, SSD offset
+
+    ref_part(ref_upload *up_, size_t len_, size_t obj_offset_) {
+	up = up_;
+	len = len_;
+	obj_offset = obj_offset_;
+	buf = (char*)aligned_alloc(512, len);
+    }
+    ~ref_part() {
+	free(buf);
+    }
+    void start(nvme *journal) {
+	n_reads += reads.size();
+	for (auto [ptr, bytes, j_offset] : reads)
+	    journal->make_read_request(ptr, bytes, j_offset)->run(this);
+	notify(NULL);
+    }
+    void notify(request *child);
+};
+
+class ref_upload : public trivial_request {
+    static const size_t ref_part_size = 1024*1024;
+    static const int    ref_depth = 2;
+
+    backend *objstore;
+    nvme    *journal;
+    batch   *b;
+    std::string name;
+    int      hdr_sectors;
+    iovec    hdr_iov;
+    request *parent = NULL;
+
+    std::mutex m;
+    int      in_flight = 0;
+    size_t   done = 0;		// bytes of data written
+    size_t   next = 0;		// next byte of data to read
+    size_t   i = 0;		// b->entries[i] contains next...
+    size_t   i_offset = 0;	// ...and starts here
+
+    /* gather [next, next+len) of the object data from the journal,
+     * or from b->buf for copied entries. Caller holds m
+     */
+    ref_part *next_part(void) {
+	size_t obj_offset = hdr_sectors*512L + next;
+	size_t len = std::min(ref_part_size - obj_offset % ref_part_size,
+			      b->len - next);
+	auto p = new ref_part(this, len, obj_offset);
+
+	for (size_t pos = 0; pos < len; ) {
+	    size_t e_bytes = b->entries[i].len * 512;
+	    size_t skip = next + pos - i_offset;
+	    size_t n = std::min(e_bytes - skip, len - pos);
+	    if (b->refs[i] < 0)
+		memcpy(p->buf + pos, b->buf + next + pos, n);
+	    else
+		p->reads.push_back(std::make_tuple(p->buf + pos, n,
+						   b->refs[i] + skip));
+	    pos += n;
+	    if (skip + n == e_bytes) {
+		i_offset += e_bytes;
+		i++;
+	    }
+	}
+	next += len;
+	in_flight++;
+	return p;
+    }
+
+public:
+    ref_upload(backend *objstore_, nvme *journal_, batch *b_,
+	       const char *name_, char *hdr, int hdr_sectors_) {
+	objstore = objstore_;
+	journal = journal_;
+	b = b_;
+	name = name_;
+	hdr_sectors = hdr_sectors_;
+	hdr_iov = (iovec){hdr, (size_t)hdr_sectors*512};
+    }
+    ~ref_upload() {}
+
+    void run(request *parent_) {
+	std::vector<ref_part*> parts;
+	std::unique_lock lk(m);
+	parent = parent_;
+	while (next < b->len && in_flight < ref_depth)
+	    parts.push_back(next_part());
+	lk.unlock();
+	for (auto p : parts)
+	    p->start(journal);
+    }
+
+    /* data for @p is in memory - send it to the backend
+     */
+    void write_part(ref_part *p) {
+	obj_set_crcs((char*)hdr_iov.iov_base, p->buf, p->obj_offset, p->len);
+	iovec iov = {p->buf, p->len};
+	auto req = objstore->make_write_req(name.c_str(), p->obj_offset,
+					    &iov, 1);
+	req->run(p);
+    }
+
+    /* @p is on the backend. Once all of them are, write the header
+     */
+    void part_done(ref_part *p) {
+	std::unique_lock lk(m);
+	done += p->len;
+	delete p;
+	in_flight--;
+	if (next < b->len) {
+	    auto p2 = next_part();
+	    lk.unlock();
+	    p2->start(journal);
+	    return;
+	}
+	if (done < b->len)
+	    return;
+	lk.unlock();
+	obj_seal_hdr((char*)hdr_iov.iov_base);
+	auto req = objstore->make_write_req(name.c_str(), 0, &hdr_iov, 1);
+	auto _parent = parent;
+	delete this;
+	req->run(_parent);
+    }
+
+    void notify(request *child) {}
 };
 
+void ref_part::notify(request *child) {
+    if (child)
+	child->release();
+    if (!writing) {
+	if (--n_reads > 0)
+	    return;
+	writing = true;
+	up->write_part(this);
+    }
+    else
+	up->part_done(this);
+}
+
 class translate_impl : public translate {
     /* lock ordering: lock m before *map_lock
      */
@@ -85,26 +377,160 @@ class translate_impl : public translate {
     friend class translate_req;
     batch *b = NULL;
     
-    /* info on all live objects - all sizes in sectors */
-    struct obj_info {
-	int hdr;		// sectors
-	int data;		// sectors
-	int live;		// sectors
-	enum obj_type type;	// LSVD_DATA or LSVD_CKPT
-    };
-    std::map<int,obj_info> object_info;
+    /* info on all live objects - see obj_table.h */
+    obj_table object_info;
 
     std::vector<uint32_t> checkpoints;
+
+    /* objects cleaned by GC are recorded in each checkpoint, and
+     * deleted in the background once the write frontier is
+     * cfg->gc_delete_grace objects past them and a checkpoint
+     * recording their cleaning is in the superblock.
+     */
+    std::vector<deferred_delete> deferred_deletes;
+    int ckpt_durable = 0;
+
+    /* snapshots, oldest first. Each is a checkpoint which is listed
+     * in the superblock and never deleted, plus a reference on each
+     * object its map points to (obj_table::snap_ref) so that GC
+     * leaves them alone. No data is copied to create one.
+     */
+    struct snapshot {
+	int seq;		// its checkpoint
+	std::string name;
+	std::vector<int> objs;	// pinned
+    };
+    std::vector<snapshot> snapshots;
+    uint64_t last_cache_seq = 0; // newest write, for snap_rollback
+    bool is_snap(int ckpt);
+    void delete_ckpt(int ckpt);
+    bool write_super(std::unique_lock<std::mutex> &lk);
+    size_t super_bytes(void);
+
+    /* clones (see translate_clone_image): objects up to the last
+     * base's sequence number belong to the images in the superblock
+     * clone list, oldest ancestor first, each of which owns the
+     * numbers up to its own. They're pinned like snapshot objects,
+     * and never deleted.
+     */
+    struct clone_base {
+	uuid_t uuid;
+	int seq;
+	std::string name;
+    };
+    std::vector<clone_base> bases;
+    int clone_seq(void) {
+	return bases.empty() ? 0 : bases.back().seq;
+    }
     
-    /* tracking completions for flush()
+    /* tracking completions for flush() etc. Objects may be in
+     * flight for a long time on high-latency backends, so there's
+     * no fixed limit on how many are outstanding.
      */
-    int       next_compln = 1;
+    compln_tracker completions;
     int       last_sent = 0;	// most recent data object
+
+    /* LBA -> data in the open batch and in data objects still being
+     * written, so reads don't have to wait for the backend. Entries
+     * point into batch::buf, and are trimmed before it's freed.
+     */
+    extmap::bufmap bufmap;
+    std::mutex     bufmap_m;	// leaf lock
+    void bufmap_release(batch *b);
+
+    /* journal-reference batches: cache sequence numbers pinned by
+     * batches that aren't on the backend yet
+     */
+    nvme *journal = NULL;
+    std::multiset<uint64_t> ref_pins;
+    std::atomic<uint64_t> oldest_pin = UINT64_MAX;
+    void unpin(batch *b);
+    void make_room(uint64_t cache_seq, size_t len,
+		   std::unique_lock<std::mutex> &lk, int n_entries = 1);
+    void copy_buffered(int64_t base, int64_t limit, smartiov *iov);
     
-    std::vector<bool> done;
-    std::condition_variable cv;
+    std::condition_variable cv;	// super_busy, shutdown
+    std::condition_variable flush_cv; // first write to an empty batch
     bool stopped = false;	// stop GC from writing
+    bool super_busy = false;	// superblock write in progress
+    bool gc_paused = false;	// snap_rollback in progress
+
+    /* lazy open (cfg->lazy_open): the shards of a sharded checkpoint
+     * map are merged into the map on first access, or in the
+     * background by load_thread. Until they're all in, live counts
+     * are low for data the checkpoint points to, so GC, defrag and
+     * checkpoints wait for map_loaded.
+     */
+    int lazy_ckpt = -1;
+    std::vector<ckpt_shard> lazy_shards;
+    std::vector<char> shard_state; // 0: not loaded, 1: loading, 2: done
+    int shards_left = 0;
+    std::atomic<bool> map_loaded = true;
+    std::condition_variable shard_cv;
+    extmap::cachemap2 lazy_trims; // shard data to drop when merged
+    void load_shard(int i, std::unique_lock<std::mutex> &lk);
+    void load_thread(thread_pool<int> *p);
+
+    /* map snapshot region in the cache file (see j_map_snap)
+     */
+    int snap_fd = -1;
+    int snap_base = 0, snap_blocks = 0;
+    bool read_map_snapshot(int ckpt, std::vector<ckpt_obj> &objects,
+			   std::vector<deferred_delete> &deletes,
+			   std::vector<ckpt_mapentry> &entries);
     
+    /* adaptive batch sizing: a window of recent data object uploads
+     * and the rate at which writes arrive. See next_batch_size()
+     */
+    struct upload {
+	size_t bytes;
+	double usecs;		// latency
+	std::chrono::system_clock::time_point done;
+    };
+    static const int n_window = 32;
+    std::vector<upload> uploads;	// ring, n_window entries
+    int       n_uploads = 0;
+    size_t    batch_bytes = 0;		// current target
+    size_t    arrived_bytes = 0;
+    double    arrival_rate = 0;		// bytes/usec
+    std::chrono::system_clock::time_point arrival_t0;
+
+    uint64_t  objs_written = 0;
+    uint64_t  bytes_written = 0;
+    uint64_t  trimmed_sectors = 0;
+    uint64_t  size_hist[16] = {0};	// see xlate_stats
+
+    void upload_done(size_t bytes,
+		     std::chrono::system_clock::time_point t0);
+    size_t next_batch_size(void);
+
+    /* data CRC checks (cfg->crc_verify). Headers of the last few
+     * objects checked are kept, under crc_m (a leaf lock).
+     */
+    std::mutex             crc_m;
+    std::map<int,char*>    crc_hdrs;
+    std::deque<int>        crc_fifo;
+    static const size_t    crc_max_hdrs = 32;
+    std::atomic<uint64_t>  crc_reads = 0;
+    std::atomic<uint64_t>  crc_checks = 0;
+    std::atomic<uint64_t>  crc_errors = 0;
+    bool crc_sample(void);
+    int read_checked(int obj, size_t offset, char *buf, size_t len);
+
+    /* inline dedup (cfg->dedup_blocks): fingerprints of 4KB blocks
+     * in recent data objects, up to cfg->dedup_blocks of them with
+     * FIFO replacement. Objects with dedup references in the open
+     * batch are pinned in dedup_pins, and GC leaves them alone.
+     */
+    std::unordered_map<fingerprint,extmap::obj_offset,
+		       fingerprint_hash> dedup_index;
+    std::deque<fingerprint> dedup_fifo;
+    std::map<int,int>       dedup_pins;
+    uint64_t dedup_lookups = 0;
+    uint64_t dedup_hits = 0;
+    bool dedup_lookup(const fingerprint &fp, extmap::obj_offset &ptr);
+    void dedup_add(batch *b, int hdr_sectors);
+
     /* various constant state
      */
     char      single_prefix[128];
@@ -124,13 +550,26 @@ class translate_impl : public translate {
     sector_t total_sectors = 0;
     sector_t total_live_sectors = 0;
     int gc_cycles = 0;
-    int gc_sectors_read = 0;
+    std::atomic<int> gc_sectors_read = 0;
     int gc_sectors_written = 0;
-    int gc_deleted = 0;
+    std::atomic<int> gc_deleted = 0;
+    int compact_cycles = 0;
+    int compact_objs = 0;
+
+    /* read heat, one counter per defrag_sectors of LBA space, for
+     * picking regions to defragment
+     */
+    static const int defrag_sectors = 2048; // 1MB
+    std::atomic<uint32_t> *heat = NULL;
+    int64_t n_regions = 0;
+    int defrag_cycles = 0;
+    void defrag_thread(thread_pool<int> *p);
+    void do_defrag(std::unique_lock<std::mutex> &lk, int64_t &budget);
 
     /* for shutdown
      */
-    bool gc_running = false;
+    int gc_running = 0;		// number of workers in a GC cycle
+    std::chrono::system_clock::time_point last_compact;
     std::condition_variable gc_cv;
     void wait_for_gc(void);
     
@@ -140,32 +579,44 @@ class translate_impl : public translate {
      *  https://stackoverflow.com/questions/15843525/how-do-you-insert-the-value-in-a-sorted-vector
      */
 
-    void write_checkpoint(int seq, std::unique_lock<std::mutex> &lk);
+    bool write_checkpoint(int seq, std::unique_lock<std::mutex> &lk);
 
     sector_t make_gc_hdr(char *buf, uint32_t seq, sector_t sectors,
 			 data_map *extents, int n_extents);
 
     void do_gc(std::unique_lock<std::mutex> &lk, bool *running);
+    void do_compact(std::unique_lock<std::mutex> &lk, bool *running);
+    void gc_clean(std::vector<std::pair<int,int>> &objs_to_clean,
+		  std::unique_lock<std::mutex> &lk);
+    struct gc_extent {
+	int64_t base;
+	int64_t limit;
+	extmap::obj_offset ptr;
+    };
+    bool gc_copy_out(int fd, extmap::cachemap &file_map,
+		     std::vector<gc_extent> &all_extents);
     void gc_thread(thread_pool<int> *p);
     void process_batch(batch *b);
+    void seal_batch(void);
+    void stream_parts(void);
+
+    /* a streaming batch already has its sequence number, so it has
+     * to be sealed before anything else gets one. Caller holds m
+     */
+    void seal_stream(void) {
+	if (b->stream != NULL)
+	    seal_batch();
+    }
     void verify_live(void);
     void flush_thread(thread_pool<int> *p);
+    void delete_thread(thread_pool<int> *p);
 
     backend *objstore;
 
-    /* all objects seq<next_compln have been completed
+    /* all objects seq<completions.next() have been completed
      */
     void notify_complete(int _seq) {
-	std::unique_lock lk(m);
-	auto moved = false;
-	done[_seq % 128] = true;
-	while (done[next_compln % 128]) {
-	    done[next_compln % 128] = false;
-	    next_compln++;
-	    moved = true;
-	}
-	if (moved) 
-	    cv.notify_all();
+	completions.complete(_seq);
     }
 
 public:
@@ -184,9 +635,39 @@ public:
     ssize_t readv(size_t offset, iovec *iov, int iovcnt);
     bool check_object_ready(int obj);
     void wait_object_ready(int obj);
+    void note_read(size_t offset, size_t len);
+    bool read_buffered(size_t offset, smartiov *iov);
+    bool verify_read(int obj, size_t offset, const char *buf, size_t len,
+		     bool always);
+    void load_map(size_t offset, size_t len);
+    void set_map_snapshot(int fd, int base, int blocks) {
+	snap_fd = fd;
+	snap_base = base;
+	snap_blocks = blocks;
+    }
+    int write_map_snapshot(void);
+    ssize_t writev_ref(uint64_t cache_seq, size_t offset, size_t len,
+		       size_t j_offset);
+    ssize_t trim(uint64_t cache_seq, size_t offset, size_t len);
+    int snap_create(const char *name);
+    int snap_remove(const char *name);
+    int snap_rollback(const char *name);
+    void snap_list(std::vector<std::pair<int,std::string>> &snaps);
+    int map_iterate(int since, uint64_t offset, uint64_t len,
+		    int (*cb)(uint64_t, size_t, int, void*), void *arg);
+    int diff_iterate(const char *snap, uint64_t offset, uint64_t len,
+		     int (*cb)(uint64_t, size_t, int, void*), void *arg);
+    int repack(int nthreads);
+    void set_journal(nvme *j) { journal = j; }
+    uint64_t oldest_ref(void);
     void start_gc(void);
     
-    const char *prefix() { return single_prefix; }
+    const char *prefix(int seq) {
+	for (auto const &c : bases)
+	    if (seq <= c.seq)
+		return c.name.c_str();
+	return single_prefix;
+    }
     
     /* debug functions
      */
@@ -195,13 +676,14 @@ public:
     int mapsize(void) { return map->size(); }
     void reset(void) { map->reset(); }
     int frontier(void) { return b->len / 512; }
+    void get_stats(xlate_stats *s);
     int batch_seq(void) { return seq; }
     void set_completion(int next);
 };
 
 translate_impl::translate_impl(backend *_io, lsvd_config *cfg_,
 			       extmap::objmap *map_, std::shared_mutex *m_) :
-    done(128,false) {
+    uploads(n_window) {
     misc_threads = new thread_pool<int>(&m);
     objstore = _io;
     parser = new object_reader(objstore);
@@ -216,14 +698,23 @@ translate *make_translate(backend *_io, lsvd_config *cfg,
 }
 
 translate_impl::~translate_impl() {
-    stopped = true;
-    cv.notify_all();
+    {
+	std::unique_lock lk(m);
+	stopped = true;
+	cv.notify_all();
+	flush_cv.notify_all();
+	shard_cv.notify_all();
+	completions.wake_all();
+    }
     delete misc_threads;	// TODO: move to shutdown(), call from rbd_close
     if (b) 
 	delete b;
+    delete[] heat;
     delete parser;
     if (super_buf)
 	free(super_buf);
+    for (auto [obj, hdr] : crc_hdrs)
+	free(hdr);
 }
 
 ssize_t translate_impl::init(const char *prefix_,
@@ -254,11 +745,24 @@ ssize_t translate_impl::init(const char *prefix_,
 
     memcpy(&uuid, super_h->vol_uuid, sizeof(uuid));
 
-    b = new batch(cfg->batch_size);
+    for (auto ci : clones) {
+	clone_base c = {{0}, (int)ci->sequence,
+			std::string(ci->name, ci->name_len)};
+	memcpy(c.uuid, ci->vol_uuid, sizeof(uuid_t));
+	bases.push_back(c);
+	do_log("clone base %s: objects <= %d\n", c.name.c_str(), c.seq);
+    }
+
+    arrival_t0 = std::chrono::system_clock::now();
+    b = new batch(next_batch_size(), cfg->xlate_refs);
+
+    n_regions = div_round_up(super_sh->vol_size, defrag_sectors);
+    heat = new std::atomic<uint32_t>[n_regions]();
 
     /* actually we're going to forget about next_obj
      */
-    seq = next_compln = super_sh->next_obj;
+    seq = super_sh->next_obj;
+    completions.set_next(seq);
 
     /* read in the last checkpoint, then roll forward from there;
      */
@@ -268,15 +772,18 @@ ssize_t translate_impl::init(const char *prefix_,
 	std::vector<deferred_delete> deletes;
 	std::vector<ckpt_mapentry> entries;
 
+	if (read_map_snapshot(ckpts[n_ckpts-1], objects, deletes, entries))
+	    last_ckpt = ckpts[n_ckpts-1];
+
 	/* hmm, we should never have checkpoints listed in the
 	 * super that aren't persisted on the backend, should we?
 	 */
-	while (n_ckpts > 0) {
+	while (last_ckpt == -1 && n_ckpts > 0) {
 	    int c = ckpts[n_ckpts-1];
-	    objname name(prefix(), c);
+	    objname name(prefix(c), c);
 	    if (parser->read_checkpoint(name.c_str(), max_cache_seq,
-					ckpts, objects,
-					deletes, entries) >= 0) {
+					ckpts, objects, deletes, entries,
+					cfg->lazy_open ? &lazy_shards : NULL) >= 0) {
 		last_ckpt = c;
 		break;
 	    }
@@ -292,10 +799,10 @@ ssize_t translate_impl::init(const char *prefix_,
 	}
 
 	for (auto o : objects) {
-	    object_info[o.seq] = (obj_info){.hdr = (int)o.hdr_sectors,
+	    object_info.insert(o.seq, (obj_info){.hdr = (int)o.hdr_sectors,
 					    .data = (int)o.data_sectors,
 					    .live = (int)o.live_sectors,
-					    .type = LSVD_DATA};
+					    .type = LSVD_DATA});
 	    total_sectors += o.data_sectors;
 	    total_live_sectors += o.live_sectors;
 	}
@@ -304,7 +811,18 @@ ssize_t translate_impl::init(const char *prefix_,
 			    (extmap::obj_offset){.obj = m.obj,
 				    .offset = m.offset});
 	}
-	seq = next_compln = last_ckpt + 1;
+	for (auto d : deletes)	// a base's deletes aren't ours
+	    if ((int)d.seq > clone_seq())
+		deferred_deletes.push_back(d);
+	seq = last_ckpt + 1;
+	completions.set_next(seq);
+
+	if (lazy_shards.size() > 0) {
+	    lazy_ckpt = last_ckpt;
+	    shards_left = lazy_shards.size();
+	    shard_state.resize(shards_left, 0);
+	    map_loaded = false;
+	}
     }
 
     /* roll forward
@@ -312,54 +830,120 @@ ssize_t translate_impl::init(const char *prefix_,
     for (; ; seq++) {
 	std::vector<obj_cleaned> cleaned;
 	std::vector<data_map>    entries;
+	std::vector<data_index>  index;
+	std::vector<ckpt_mapentry> dedup;
+	std::vector<data_map>    trims;
 	obj_hdr h; obj_data_hdr dh;
 
-	objname name(prefix(), seq);
-	if (parser->read_data_hdr(name.c_str(), h, dh, cleaned, entries) < 0)
+	objname name(prefix(seq), seq);
+	if (parser->read_data_hdr(name.c_str(), h, dh, cleaned, entries,
+				  &index, &dedup, &trims) < 0)
 	    break;
 	if (h.type == LSVD_CKPT) {
 	    do_log("ckpt from roll-forward: %d\n", seq.load());
 	    checkpoints.push_back(seq);
+
+	    /* each checkpoint has the full list of pending deletes
+	     */
+	    uint64_t _cache_seq;
+	    std::vector<uint32_t> _ckpts;
+	    std::vector<ckpt_obj> _objects;
+	    std::vector<deferred_delete> deletes;
+	    std::vector<ckpt_mapentry> _entries;
+	    if (parser->read_checkpoint(name.c_str(), _cache_seq, _ckpts,
+					_objects, deletes, _entries) >= 0)
+		deferred_deletes = deletes;
 	    continue;
 	}
 
+	/* the index leaves out data overwritten in the same object
+	 */
 	assert(h.type == LSVD_DATA);
-	object_info[seq] = (obj_info){.hdr = (int)h.hdr_sectors,
+	int live = 0;
+	for (auto e : index)
+	    live += e.len;
+	object_info.insert(seq, (obj_info){.hdr = (int)h.hdr_sectors,
 				      .data = (int)h.data_sectors,
-				      .live = (int)h.data_sectors,
-				      .type = LSVD_DATA};
+				      .live = live,
+				      .type = LSVD_DATA});
 	total_sectors += h.data_sectors;
-	total_live_sectors += h.data_sectors;
+	total_live_sectors += live;
 	if (dh.cache_seq)	// skip GC writes
 	    max_cache_seq = dh.cache_seq;
 	
-	int offset = 0, hdr_len = h.hdr_sectors;
+	int hdr_len = h.hdr_sectors;
 	std::vector<extmap::lba2obj> deleted;
-	for (auto m : entries) {
-	    extmap::obj_offset oo = {seq, offset + hdr_len};
-	    map->update(m.lba, m.lba + m.len, oo, &deleted);
-	    offset += m.len;
+	for (auto e : index) {
+	    extmap::obj_offset oo = {seq, e.offset + hdr_len};
+	    map->update(e.lba, e.lba + e.len, oo, &deleted);
+	}
+	for (auto e : dedup) {
+	    extmap::obj_offset oo = {e.obj, e.offset};
+	    map->update(e.lba, e.lba + e.len, oo, &deleted);
+	    object_info.add_live(e.obj, e.len);
+	    total_live_sectors += e.len;
+	}
+	for (auto e : trims) {
+	    if (!map_loaded)
+		lazy_trims.update(e.lba, e.lba + e.len, e.lba);
+	    map->trim(e.lba, e.lba + e.len, &deleted);
 	}
 	for (auto d : deleted) {
 	    auto [base, limit, ptr] = d.vals();
-	    object_info[ptr.obj].live -= (limit - base);
-	    assert(object_info[ptr.obj].live >= 0);
+	    object_info.add_live(ptr.obj, -(limit - base));
 	    total_live_sectors -= (limit - base);
 	}
 	verify_live();
     }
-    next_compln = seq;
+    completions.set_next(seq);
+    if (!checkpoints.empty())
+	ckpt_durable = checkpoints.back();
+
+    for (int obj = object_info.first();
+	 obj < object_info.limit() && obj <= clone_seq(); obj++)
+	if (object_info.find(obj))
+	    object_info.snap_ref(obj, 1);
+
+    /* pin the objects each snapshot points to, going by the live
+     * counts in its checkpoint, so we don't have to fetch its map
+     */
+    for (auto si : snaps) {
+	snapshot s = {(int)si->seq, std::string(si->name, si->name_len), {}};
+	uint64_t _cache_seq;
+	std::vector<uint32_t> _ckpts;
+	std::vector<ckpt_obj> _objects;
+	std::vector<deferred_delete> _deletes;
+	std::vector<ckpt_mapentry> _entries;
+	std::vector<ckpt_shard> _shards;
+	objname name(prefix(s.seq), s.seq);
+	if (parser->read_checkpoint(name.c_str(), _cache_seq, _ckpts,
+				    _objects, _deletes, _entries,
+				    &_shards) < 0) {
+	    do_log("snapshot %s: missing checkpoint %d\n", s.name.c_str(),
+		   s.seq);
+	    return -1;
+	}
+	for (auto o : _objects)
+	    if (o.live_sectors > 0 && object_info.find(o.seq)) {
+		object_info.snap_ref(o.seq, 1);
+		s.objs.push_back(o.seq);
+	    }
+	snapshots.push_back(s);
+    }
     
     /* delete any potential "dangling" objects.
      */
     for (int i = 1; i < 32; i++) {
-	objname name(prefix(), i + seq);
+	objname name(prefix(i + seq), i + seq);
 	if (objstore->delete_object(name.c_str()) == 0) {
 	    printf("deleted %s (next=%08x)\n", name.c_str(), (int)seq);
 	    do_log("deleted %s (next=%08x)\n", name.c_str(), (int)seq);
 	}
     }
 
+    if (!map_loaded)
+	misc_threads->pool.push(std::thread(&translate_impl::load_thread,
+					    this, misc_threads));
     if (timedflush)
 	misc_threads->pool.push(std::thread(&translate_impl::flush_thread,
 					    this, misc_threads));
@@ -367,13 +951,122 @@ ssize_t translate_impl::init(const char *prefix_,
 }
 
 void translate_impl::start_gc(void) {
-    misc_threads->pool.push(std::thread(&translate_impl::gc_thread,
-				       this, misc_threads));
+    last_compact = std::chrono::system_clock::now();
+    for (int i = 0; i < std::max(cfg->gc_threads, 1); i++)
+	misc_threads->pool.push(std::thread(&translate_impl::gc_thread,
+					    this, misc_threads));
+    misc_threads->pool.push(std::thread(&translate_impl::delete_thread,
+					this, misc_threads));
+    if (cfg->defrag_mbps > 0)
+	misc_threads->pool.push(std::thread(&translate_impl::defrag_thread,
+					    this, misc_threads));
 }
     
 void translate_impl::shutdown(void) {
 }
 
+/* merge checkpoint shard @i into the map, under anything written
+ * since the checkpoint (roll-forward or new writes). Caller holds m
+ * (via @lk), which is dropped while the shard is fetched.
+ */
+void translate_impl::load_shard(int i, std::unique_lock<std::mutex> &lk) {
+    while (shard_state[i] == 1)
+	shard_cv.wait(lk);
+    if (shard_state[i] == 2)
+	return;
+    shard_state[i] = 1;
+    lk.unlock();
+
+    uint64_t _cache_seq;
+    std::vector<uint32_t> _ckpts;
+    std::vector<ckpt_obj> _objects;
+    std::vector<deferred_delete> _deletes;
+    std::vector<ckpt_mapentry> entries;
+    objname name(prefix(lazy_ckpt), lazy_ckpt, i);
+    if (parser->read_checkpoint(name.c_str(), _cache_seq, _ckpts, _objects,
+				_deletes, entries) < 0 ||
+	entries.size() != lazy_shards[i].n_entries) {
+	do_log("failed to load %s\n", name.c_str());
+	throw("ckpt shard");
+    }
+    lk.lock();
+
+    auto [base, limit, n] = lazy_shards[i];
+    std::unique_lock objlock(*map_lock);
+    std::vector<extmap::lba2obj> newer, deleted;
+    for (auto it = map->lookup(base);
+	 it != map->end() && it->base() < limit; it++) {
+	auto [_base, _limit, ptr] = it->vals(base, limit);
+	newer.push_back(extmap::lba2obj(_base, _limit - _base, ptr));
+    }
+    for (auto e : entries)
+	map->update(e.lba, e.lba + e.len,
+		    (extmap::obj_offset){.obj = e.obj, .offset = e.offset});
+
+    /* drop anything discarded since the checkpoint; if it's been
+     * written since then it's in @newer, so leave that part alone
+     */
+    extmap::cachemap2 trimmed;
+    for (auto it = lazy_trims.lookup(base);
+	 it != lazy_trims.end() && it->base() < limit; it++) {
+	auto [_base, _limit, _lba] = it->vals(base, limit);
+	trimmed.update(_base, _limit, _lba);
+    }
+    for (auto e : newer) {
+	auto [_base, _limit, ptr] = e.vals();
+	trimmed.trim(_base, _limit);
+    }
+    for (auto it = trimmed.begin(); it != trimmed.end(); it++)
+	map->trim(it->s.base, it->s.base + it->s.len, &deleted);
+    for (auto e : newer) {
+	auto [_base, _limit, ptr] = e.vals();
+	map->update(_base, _limit, ptr, &deleted);
+    }
+
+    /* roll-forward and writes since open didn't see the data they
+     * replaced, so account for it now
+     */
+    for (auto d : deleted) {
+	auto [_base, _limit, ptr] = d.vals();
+	if (ptr.obj < lazy_ckpt && object_info.find(ptr.obj)) {
+	    object_info.add_live(ptr.obj, -(_limit - _base));
+	    total_live_sectors -= (_limit - _base);
+	}
+    }
+    objlock.unlock();
+
+    shard_state[i] = 2;
+    if (--shards_left == 0) {
+	map_loaded = true;
+	lazy_trims.reset();
+	do_log("map loaded (%d shards)\n", (int)lazy_shards.size());
+    }
+    shard_cv.notify_all();
+}
+
+/* make sure the map is complete for [offset, offset+len)
+ */
+void translate_impl::load_map(size_t offset, size_t len) {
+    if (map_loaded)
+	return;
+    int64_t base = offset / 512, limit = (offset + len) / 512;
+    std::unique_lock lk(m);
+    for (int i = 0; i < (int)lazy_shards.size(); i++)
+	if (lazy_shards[i].base < limit && lazy_shards[i].limit > base)
+	    load_shard(i, lk);
+}
+
+/* fetch the rest of the shards in the background
+ */
+void translate_impl::load_thread(thread_pool<int> *p) {
+    pthread_setname_np(pthread_self(), "load_thread");
+    parallel_for(lazy_shards.size(), cfg->ckpt_threads, [&](int i) {
+	    std::unique_lock lk(m);
+	    if (p->running)
+		load_shard(i, lk);
+	});
+}
+
 /* ----------- parsing and serializing various objects -------------*/
 
 /* read object header
@@ -382,19 +1075,27 @@ void translate_impl::shutdown(void) {
  */
 
 
-/* create header for a GC object
+/* create header for a GC object. The data CRCs are filled in
+ * later (obj_set_crcs, obj_seal_hdr), once the data's been copied.
  */
 sector_t translate_impl::make_gc_hdr(char *buf, uint32_t _seq, sector_t sectors,
 				     data_map *extents, int n_extents) {
     auto h = (obj_hdr*)buf;
     auto dh = (obj_data_hdr*)(h+1);
+    std::vector<data_map> entries(extents, extents + n_extents);
+    std::vector<data_index> index;
+    make_data_index(&entries, index);
+
     uint32_t o1 = sizeof(*h) + sizeof(*dh),
 	l1 = sizeof(uint32_t) * checkpoints.size(),
 	o2 = o1 + l1, l2 = n_extents * sizeof(data_map),
-	hdr_bytes = o2 + l2;
+	o3 = o2 + l2, l3 = index.size() * sizeof(data_index),
+	o4 = o3 + l3, l4 = obj_crcs_len(o4, sectors*512L),
+	hdr_bytes = o4 + l4;
     sector_t hdr_sectors = div_round_up(hdr_bytes, 512);
 
-    *h = (obj_hdr){.magic = LSVD_MAGIC, .version = 1, .vol_uuid = {0},
+    *h = (obj_hdr){.magic = LSVD_MAGIC, .version = LSVD_OBJ_VERSION,
+		   .vol_uuid = {0},
 		   .type = LSVD_DATA, .seq = _seq,
 		   .hdr_sectors = (uint32_t)hdr_sectors,
 		   .data_sectors = (uint32_t)sectors, .crc = 0};
@@ -402,7 +1103,11 @@ sector_t translate_impl::make_gc_hdr(char *buf, uint32_t _seq, sector_t sectors,
 
     *dh = (obj_data_hdr){.cache_seq = 0,
 			 .objs_cleaned_offset = 0, .objs_cleaned_len = 0,
-			 .data_map_offset = o2, .data_map_len = l2};
+			 .data_map_offset = o2, .data_map_len = l2,
+			 .data_crcs_offset = o4, .data_crcs_len = l4,
+			 .data_index_offset = o3, .data_index_len = l3,
+			 .dedup_map_offset = 0, .dedup_map_len = 0,
+			 .trim_map_offset = 0, .trim_map_len = 0};
 
     uint32_t *p_ckpt = (uint32_t*)(dh+1);
     for (auto c : checkpoints)
@@ -411,11 +1116,13 @@ sector_t translate_impl::make_gc_hdr(char *buf, uint32_t _seq, sector_t sectors,
     data_map *dm = (data_map*)p_ckpt;
     for (int i = 0; i < n_extents; i++)
 	*dm++ = extents[i];
+    data_index *di = (data_index*)dm;
+    for (auto e : index)
+	*di++ = e;
+
+    assert(o4 == ((char*)di - buf));
+    memset(buf + o4, 0, 512*hdr_sectors - o4); // valgrind
 
-    assert(hdr_bytes == ((char*)dm - buf));
-    memset(buf + hdr_bytes, 0, 512*hdr_sectors - hdr_bytes); // valgrind
-    h->crc = (uint32_t)crc32(0, (const unsigned char*)buf, 512*hdr_sectors);
-    
     return hdr_sectors;
 }
 
@@ -425,86 +1132,360 @@ sector_t translate_impl::make_gc_hdr(char *buf, uint32_t _seq, sector_t sectors,
  */
 ssize_t translate_impl::writev(uint64_t cache_seq, size_t offset,
 			       iovec *iov, int iovcnt) {
-    std::unique_lock lk(m);
     smartiov siov(iov, iovcnt);
     size_t len = siov.bytes();
     //do_log("t %d+%d %d\n", offset/512, len/512, ((int*)iov->iov_base)[1]);
-    
-    if (b->len + len > b->max) {
-	b->seq = last_sent = seq++;
-	auto tmp = b;
-	b = new batch(cfg->batch_size);
-	process_batch(tmp);
-	int _seq = 0;
-	if (!checkpoints.empty())
-	    _seq = checkpoints.back();
-	if (seq - _seq > cfg->ckpt_interval)
-	    write_checkpoint(seq++, lk);
+
+    /* fingerprint each whole 4KB block before taking the lock
+     */
+    std::vector<fingerprint> fps;
+    if (cfg->dedup_blocks > 0) {
+	char *tmp = (iovcnt > 1) ? (char*)malloc(dedup_block) : NULL;
+	for (size_t i = 0; i + dedup_block <= len; i += dedup_block) {
+	    auto slice = siov.slice(i, i + dedup_block);
+	    char *p = (char*)slice[0].iov_base;
+	    if (slice.size() > 1) {
+		slice.copy_out(tmp);
+		p = tmp;
+	    }
+	    fps.push_back(block_fingerprint(p));
+	}
+	free(tmp);
     }
+    
+    std::unique_lock lk(m);
+    make_room(cache_seq, len, lk, fps.size() + 1);
 
-    if (b->cache_seq == 0) {	// lowest sequence number
-	b->cache_seq = cache_seq;
-	if (ckpt_cache_seq < cache_seq)
-	    ckpt_cache_seq = cache_seq;
+    /* copy [_base,_limit) of the write into the batch
+     */
+    auto append = [&](size_t _base, size_t _limit) {
+	if (_base == _limit)
+	    return;
+	auto slice = siov.slice(_base, _limit);
+	int data_offset = b->len / 512;
+	b->append((offset + _base) / 512, &slice);
+	char *ptr = b->buf + b->len - (_limit - _base);
+	for (size_t i = _base; !fps.empty() && i + dedup_block <= _limit;
+	     i += dedup_block)
+	    b->fps.push_back(std::make_pair(fps[i / dedup_block],
+					    data_offset + (i - _base) / 512));
+	std::unique_lock lk2(bufmap_m);
+	bufmap.update((offset + _base)/512, (offset + _limit)/512, ptr);
+    };
+
+    /* blocks we already have just get mapped to the old copy
+     */
+    size_t done = 0;
+    for (size_t i = 0; i < fps.size(); i++) {
+	extmap::obj_offset ptr;
+	if (!dedup_lookup(fps[i], ptr))
+	    continue;
+	size_t base = i * dedup_block, limit = base + dedup_block;
+	append(done, base);
+	int64_t lba = (offset + base) / 512;
+	b->dups.update(lba, lba + dedup_block/512, ptr);
+	b->trims.trim(lba, lba + dedup_block/512);
+	b->dup_objs.push_back(ptr.obj);
+	dedup_pins[ptr.obj]++;
+	std::unique_lock lk2(bufmap_m);
+	bufmap.trim(lba, lba + dedup_block/512);
+	done = limit;
     }
-    b->append(offset / 512, &siov);
+    append(done, len);
 
+    if (cfg->stream_part > 0)
+	stream_parts();
     return len;
 }
 
-void translate_impl::wait_for_room(void) {
-    std::unique_lock lk(m);
-    while (next_compln - last_sent > cfg->xlate_window)
-	cv.wait(lk);
+/* look up a block fingerprint, returning false if we don't have it
+ * or the object it's in is going away. Caller holds m
+ */
+bool translate_impl::dedup_lookup(const fingerprint &fp,
+				  extmap::obj_offset &ptr) {
+    dedup_lookups++;
+    auto it = dedup_index.find(fp);
+    if (it == dedup_index.end())
+	return false;
+    ptr = it->second;
+    if (object_info.find(ptr.obj) == NULL || object_info.busy(ptr.obj)) {
+	dedup_index.erase(it);
+	return false;
+    }
+    dedup_hits++;
+    return true;
 }
 
-/* GC (like normal write) updates the map before it writes an object,
- * but we can't assume the data is in cache, so we might get writes
- * for objects that haven't committed yet.
- * since this almost never blocks, do an unlocked check before the
- * locked one.
+/* add the blocks uploaded in batch @b to the dedup index, and unpin
+ * the objects its dedup entries point to. Caller holds m
  */
-bool translate_impl::check_object_ready(int obj) {
-    return obj < (int)next_compln;
+void translate_impl::dedup_add(batch *b, int hdr_sectors) {
+    for (auto obj : b->dup_objs)
+	if (--dedup_pins[obj] == 0)
+	    dedup_pins.erase(obj);
+
+    for (auto [fp, offset] : b->fps) {
+	if (dedup_index.find(fp) != dedup_index.end())
+	    continue;
+	dedup_index[fp] = (extmap::obj_offset){b->seq, hdr_sectors + offset};
+	dedup_fifo.push_back(fp);
+	if (dedup_fifo.size() > (size_t)cfg->dedup_blocks) {
+	    dedup_index.erase(dedup_fifo.front());
+	    dedup_fifo.pop_front();
+	}
+    }
 }
-void translate_impl::wait_object_ready(int obj) {
+
+/* journal-reference version of writev: the data is already on the
+ * write cache SSD at @j_offset, and we read it back at upload time.
+ * The journal record can't be reused until oldest_ref() moves past it.
+ */
+ssize_t translate_impl::writev_ref(uint64_t cache_seq, size_t offset,
+				   size_t len, size_t j_offset) {
     std::unique_lock lk(m);
-    while (obj >= next_compln)
-	cv.wait(lk);
+    if (b->stream != NULL)
+	seal_batch();
+    make_room(cache_seq, len, lk);
+    if (b->pin_seq == 0) {
+	b->pin_seq = cache_seq;
+	ref_pins.insert(cache_seq);
+	oldest_pin = *ref_pins.begin();
+    }
+    b->append_ref(offset / 512, len, j_offset);
+
+    /* anything in bufmap for this range is older
+     */
+    std::unique_lock lk2(bufmap_m);
+    bufmap.trim(offset/512, (offset+len)/512);
+    return len;
 }
 
+/* discard [offset, offset+len): it comes out of the map (and the
+ * live counts) right away so GC sees the garbage, and goes in the
+ * trim map of the open batch so it's in the next object header.
+ */
+ssize_t translate_impl::trim(uint64_t cache_seq, size_t offset,
+			     size_t len) {
+    int64_t base = offset / 512, limit = (offset + len) / 512;
+    std::unique_lock lk(m);
+    make_room(cache_seq, 0, lk, div_round_up(limit - base, max_trim_len));
+    b->dups.trim(base, limit);
+    b->trims.update(base, limit, base);
 
-class translate_req : public trivial_request {
-    uint32_t seq;
-    translate_impl *tx;
-    friend class translate_impl;
-    
-    /* various things that we might need to free
-     */
-    std::vector<char*> to_free;
-    batch *b = NULL;
-    
-public:
-    translate_req(uint32_t seq_, translate_impl *tx_) {
-	seq = seq_;
-	tx = tx_;
-    }
-    ~translate_req(){}
+    std::unique_lock lk2(bufmap_m);
+    bufmap.trim(base, limit);
+    lk2.unlock();
 
-    void notify(request *child) {
-	if (child)
-	    child->release();
-	tx->notify_complete(seq);
-	for (auto ptr : to_free)
-	    free(ptr);
-	if (b) 
-	    delete b;
-	delete this;
+    std::unique_lock objlock(*map_lock);
+    if (!map_loaded)
+	lazy_trims.update(base, limit, base);
+    std::vector<extmap::lba2obj> deleted;
+    map->trim(base, limit, &deleted);
+    for (auto d : deleted) {
+	auto [_base, _limit, ptr] = d.vals();
+	object_info.add_live(ptr.obj, -(_limit - _base));
+	total_live_sectors -= (_limit - _base);
     }
-};
+    trimmed_sectors += (limit - base);
+    return len;
+}
 
-void translate_impl::process_batch(batch *b) {
-    assert(!m.try_lock());
+uint64_t translate_impl::oldest_ref(void) {
+    return oldest_pin.load();
+}
+
+void translate_impl::unpin(batch *b) {
+    if (b->pin_seq == 0)
+	return;
+    std::unique_lock lk(m);
+    ref_pins.erase(ref_pins.find(b->pin_seq));
+    oldest_pin = ref_pins.empty() ? UINT64_MAX : *ref_pins.begin();
+}
+
+/* seal the batch if @len more bytes (in up to @n_entries header
+ * entries) won't fit, with a checkpoint if it's time, and note the
+ * first write and cache sequence number. Caller holds m (via @lk)
+ */
+void translate_impl::make_room(uint64_t cache_seq, size_t len,
+			       std::unique_lock<std::mutex> &lk,
+			       int n_entries) {
+    int n = b->entries.size() + b->dups.size() + b->trims.size() +
+	n_entries;
+    bool hdr_full = (b->stream != NULL &&
+		     obj_hdr_len(n, b->max, b->hdr_sectors) >
+		     b->hdr_sectors*512UL);
+    if (b->len + len > b->max || hdr_full) {
+	seal_batch();
+	int _seq = 0;
+	if (!checkpoints.empty())
+	    _seq = checkpoints.back();
+	if (seq - _seq > cfg->ckpt_interval && map_loaded)
+	    write_checkpoint(seq++, lk);
+    }
+
+    if (b->empty()) {
+	b->first_write = std::chrono::system_clock::now();
+	flush_cv.notify_one();
+    }
+    arrived_bytes += len;
+    if (last_cache_seq < cache_seq)
+	last_cache_seq = cache_seq;
+    if (b->cache_seq == 0) {	// lowest sequence number
+	b->cache_seq = cache_seq;
+	if (ckpt_cache_seq < cache_seq)
+	    ckpt_cache_seq = cache_seq;
+    }
+}
+
+/* start (or continue) uploading the open batch in parts of
+ * cfg->stream_part bytes. Caller holds m.
+ */
+void translate_impl::stream_parts(void) {
+    size_t part = cfg->stream_part;
+    if (b->len - b->sent < part || b->pin_seq != 0)
+	return;
+
+    if (b->stream == NULL) {
+	int hdr_sectors = div_round_up(cfg->stream_hdr, 512);
+	if (obj_hdr_len(b->entries.size() + b->dups.size() + b->trims.size(),
+			b->max, hdr_sectors) > hdr_sectors*512UL)
+	    return;
+	b->hdr_sectors = hdr_sectors;
+	b->seq = seq++;
+	b->stream = new stream_req;
+    }
+
+    objname name(prefix(b->seq), b->seq);
+    while (b->len - b->sent >= part) {
+	iovec iov = {b->buf + b->sent, part};
+	auto req = objstore->make_write_req(name.c_str(),
+					    b->hdr_sectors*512L + b->sent,
+					    &iov, 1);
+	b->stream->add_part(req);
+	b->sent += part;
+    }
+}
+
+/* called when a data object is on the backend, before its buffer
+ * is freed. Only trim the parts of the map that still point into
+ * this batch - anything newer points into a later one.
+ */
+void translate_impl::bufmap_release(batch *b) {
+    std::unique_lock lk(bufmap_m);
+    char *lo = b->buf, *hi = b->buf + b->len;
+    std::vector<std::pair<int64_t,int64_t>> stale;
+
+    for (auto e : b->entries) {
+	int64_t base = e.lba, limit = e.lba + e.len;
+	for (auto it = bufmap.lookup(base);
+	     it != bufmap.end() && it->base() < limit; it++) {
+	    auto [_base, _limit, ptr] = it->vals(base, limit);
+	    if (ptr.buf >= lo && ptr.buf < hi)
+		stale.push_back(std::make_pair(_base, _limit));
+	}
+    }
+    for (auto [base, limit] : stale)
+	bufmap.trim(base, limit);
+}
+
+/* copy [offset, offset+len) from memory, if all of it is in the
+ * open batch or a data object that's still being written.
+ */
+bool translate_impl::read_buffered(size_t offset, smartiov *iov) {
+    int64_t base = offset / 512, limit = base + iov->bytes() / 512;
+    std::unique_lock lk(bufmap_m);
+
+    int64_t prev = base;
+    for (auto it = bufmap.lookup(base);
+	 it != bufmap.end() && it->base() < limit; it++) {
+	auto [_base, _limit, ptr] = it->vals(base, limit);
+	if (_base != prev)
+	    return false;
+	prev = _limit;
+    }
+    if (prev != limit)
+	return false;
+
+    copy_buffered(base, limit, iov);
+    return true;
+}
+
+/* copy whatever parts of [base,limit) are in memory to @iov.
+ * Caller holds bufmap_m
+ */
+void translate_impl::copy_buffered(int64_t base, int64_t limit,
+				   smartiov *iov) {
+    for (auto it = bufmap.lookup(base);
+	 it != bufmap.end() && it->base() < limit; it++) {
+	auto [_base, _limit, ptr] = it->vals(base, limit);
+	auto slice = iov->slice((_base - base)*512, (_limit - base)*512);
+	slice.copy_in(ptr.buf);
+    }
+}
+
+void translate_impl::wait_for_room(void) {
+    std::unique_lock lk(m);
+    while (!completions.ready(last_sent - cfg->xlate_window) && !stopped)
+	completions.wait(last_sent - cfg->xlate_window, lk);
+}
+
+/* GC (like normal write) updates the map before it writes an object,
+ * but we can't assume the data is in cache, so we might get writes
+ * for objects that haven't committed yet.
+ * since this almost never blocks, do an unlocked check before the
+ * locked one.
+ */
+bool translate_impl::check_object_ready(int obj) {
+    return completions.ready(obj);
+}
+void translate_impl::wait_object_ready(int obj) {
+    std::unique_lock lk(m);
+    while (!completions.ready(obj))
+	completions.wait(obj, lk);
+}
+
+
+class translate_req : public trivial_request {
+    uint32_t seq;
+    translate_impl *tx;
+    friend class translate_impl;
+    
+    /* various things that we might need to free
+     */
+    std::vector<char*> to_free;
+    batch *b = NULL;
+
+    /* for data objects, to measure upload latency
+     */
+    size_t bytes = 0;
+    std::chrono::system_clock::time_point t0;
+    
+public:
+    translate_req(uint32_t seq_, translate_impl *tx_) {
+	seq = seq_;
+	tx = tx_;
+    }
+    ~translate_req(){}
+
+    void notify(request *child) {
+	if (child)
+	    child->release();
+	if (bytes > 0)
+	    tx->upload_done(bytes, t0);
+	tx->notify_complete(seq);
+	for (auto ptr : to_free)
+	    free(ptr);
+	if (b) {
+	    tx->bufmap_release(b);
+	    tx->unpin(b);
+	    delete b;
+	}
+	delete this;
+    }
+};
+
+void translate_impl::process_batch(batch *b) {
+    assert(!m.try_lock());
 
     /* TODO: coalesce writes: 
      *   bufmap m
@@ -519,14 +1500,33 @@ void translate_impl::process_batch(batch *b) {
      * - map - LBA to obj/offset map
      * - object_info, totals - adjust for new garbage
      */
-    size_t hdr_bytes = obj_hdr_len(b->entries.size());
-    int hdr_sectors = div_round_up(hdr_bytes, 512);
+    std::vector<ckpt_mapentry> dedup;
+    for (auto it = b->dups.begin(); it != b->dups.end(); it++) {
+	auto [base, limit, ptr] = it->vals();
+	dedup.push_back((ckpt_mapentry){.lba = base, .len = limit-base,
+		    .obj = (int32_t)ptr.obj, .offset = (int32_t)ptr.offset});
+    }
+    std::vector<data_map> trims;
+    for (auto it = b->trims.begin(); it != b->trims.end(); it++) {
+	int64_t base = it->s.base, limit = base + it->s.len;
+	for (; base < limit; base += max_trim_len) {
+	    auto len = std::min(limit - base, max_trim_len);
+	    trims.push_back((data_map){(uint64_t)base, (uint64_t)len});
+	}
+    }
+    size_t hdr_bytes = std::max(obj_hdr_len(b->entries.size() + dedup.size()
+					    + trims.size(), b->len),
+				b->hdr_sectors*512UL);
+    char *hdr = (char*)calloc(round_up(hdr_bytes, 512), 1);
+    make_data_hdr(hdr, b->len, b->cache_seq, &b->entries, b->seq, &uuid,
+		  b->hdr_sectors, b->pin_seq ? NULL : b->buf, &dedup, &trims);
+    int hdr_sectors = ((obj_hdr*)hdr)->hdr_sectors;
 
     std::unique_lock objlock(*map_lock);
     verify_live();
     obj_info oi = {.hdr = hdr_sectors, .data = (int)b->len/512,
 		   .live = (int)b->len/512, .type = LSVD_DATA};
-    object_info[b->seq] = oi;
+    object_info.insert(b->seq, oi);
 
     /* note that we update the map before the object is written,
      * and count on the write cache preventing any reads until
@@ -541,24 +1541,27 @@ void translate_impl::process_batch(batch *b) {
 	map->update(e.lba, e.lba+e.len, oo, &deleted);
 	sector_offset += e.len;
     }
+    for (auto e : dedup) {
+	extmap::obj_offset oo = {e.obj, e.offset};
+	map->update(e.lba, e.lba+e.len, oo, &deleted);
+	object_info.add_live(e.obj, e.len);
+	total_live_sectors += e.len;
+    }
+    for (auto e : trims)	// already out of the map, except for b
+	map->trim(e.lba, e.lba+e.len, &deleted);
 
     for (auto d : deleted) {
 	auto [base, limit, ptr] = d.vals();
-	assert(object_info.find(ptr.obj) != object_info.end());
-	object_info[ptr.obj].live -= (limit - base);
-	assert(object_info[ptr.obj].live >= 0);
+	object_info.add_live(ptr.obj, -(limit - base));
 	total_live_sectors -= (limit - base);
     }
     verify_live();
     objlock.unlock();
+    dedup_add(b, hdr_sectors);
 
     total_sectors += b->len/512;
     total_live_sectors += b->len/512; // not quite right if overlaps...
-    if (next_compln == -1)
-	next_compln = b->seq;
 
-    char *hdr = (char*)calloc(hdr_sectors*512, 1);
-    make_data_hdr(hdr, b->len, b->cache_seq, &b->entries, b->seq, &uuid);
     iovec iov[] = {{hdr, (size_t)(hdr_sectors*512)},
 		   {b->buf, b->len}};
 
@@ -567,59 +1570,256 @@ void translate_impl::process_batch(batch *b) {
     auto t_req = new translate_req(b->seq, this);
     t_req->to_free.push_back(hdr);
     t_req->b = b;
-
-    objname name(prefix(), b->seq);
+    t_req->bytes = hdr_sectors*512 + b->len;
+    t_req->t0 = std::chrono::system_clock::now();
+
+    objs_written++;
+    bytes_written += t_req->bytes;
+    int i = 0;
+    while (i < 15 && (t_req->bytes >> 16) >= (1UL << i))
+	i++;
+    size_hist[i]++;
+
+    objname name(prefix(b->seq), b->seq);
+    if (b->pin_seq != 0) {
+	auto up = new ref_upload(objstore, journal, b, name.c_str(),
+				 hdr, hdr_sectors);
+	up->run(t_req);
+	return;
+    }
+    if (b->stream != NULL) {
+	/* send the rest of the data, then the header when it's all there
+	 */
+	if (b->len > b->sent) {
+	    iovec iov2 = {b->buf + b->sent, b->len - b->sent};
+	    b->stream->add_part(
+		objstore->make_write_req(name.c_str(),
+					 hdr_sectors*512L + b->sent, &iov2, 1));
+	}
+	auto req = objstore->make_write_req(name.c_str(), 0, iov, 1);
+	b->stream->finish(req, t_req);
+	return;
+    }
     auto req = objstore->make_write_req(name.c_str(), iov, 2);
     req->run(t_req);
 }
 
 /* flushes any data buffered in current batch, and blocks until all 
  * outstanding writes are complete.
- * returns sequence number of last written object.
+ * returns seq - 1, the last sequence number handed out - which may be
+ * a checkpoint rather than the last data object. Anything written after
+ * this returns gets a higher number.
  */
 int translate_impl::flush() {
     std::unique_lock lk(m);
     
-    if (b->len > 0) {
-	b->seq = last_sent = seq++;
-	auto tmp = b;
-	b = new batch(cfg->batch_size);
-	process_batch(tmp);
-    }
+    seal_batch();
     auto _seq = last_sent;
 
-    while (next_compln <= _seq)
-	cv.wait(lk);
+    while (!completions.ready(_seq))
+	completions.wait(_seq, lk);
 
-    return _seq;
+    return seq - 1;		// anything written from now on is newer
+}
+
+/* send the current batch (if any) to the backend without waiting
+ * for it to complete. Caller holds m.
+ */
+void translate_impl::seal_batch(void) {
+    if (b->empty())
+	return;
+    if (b->stream == NULL)	// streaming batches already have one
+	b->seq = seq++;
+    last_sent = b->seq;
+    auto tmp = b;
+    b = new batch(next_batch_size(), cfg->xlate_refs);
+    process_batch(tmp);
+}
+
+/* called (without m held) when a data object write completes
+ */
+void translate_impl::upload_done(size_t bytes,
+				 std::chrono::system_clock::time_point t0) {
+    std::unique_lock lk(m);
+    auto now = std::chrono::system_clock::now();
+    auto usecs = std::chrono::duration<double,std::micro>(now - t0).count();
+    uploads[n_uploads++ % n_window] = (upload){bytes, usecs, now};
+}
+
+/* size of the next batch. With cfg->batch_adaptive, model upload
+ * latency as L = L0 + bytes/BW (least squares fit over the window)
+ * and pick the size S so that, at the current arrival rate R, there
+ * are xlate_window objects in flight:
+ *   R * (L0 + S/BW) = W * S   =>   S = R*L0 / (W - R/BW)
+ * If R/BW >= W the backend can't keep up at any size, so use the max.
+ */
+size_t translate_impl::next_batch_size(void) {
+    if (!cfg->batch_adaptive)
+	return cfg->batch_size;
+
+    size_t min = std::max(cfg->batch_min, cfg->wcache_chunk),
+	max = std::max((size_t)cfg->batch_max, min);
+    if (batch_bytes == 0)
+	batch_bytes = std::clamp((size_t)cfg->batch_size, min, max);
+
+    auto now = std::chrono::system_clock::now();
+    auto usecs = std::chrono::duration<double,std::micro>(now - arrival_t0).count();
+    if (usecs > 100000) {
+	double rate = arrived_bytes / usecs;
+	arrival_rate = (arrival_rate == 0) ? rate : (arrival_rate + rate) / 2;
+	arrived_bytes = 0;
+	arrival_t0 = now;
+    }
+
+    int n = std::min(n_uploads, n_window);
+    if (n < 4 || arrival_rate == 0)
+	return batch_bytes;
+
+    double mb = 0, ml = 0, var = 0, cov = 0;
+    for (int i = 0; i < n; i++) {
+	mb += uploads[i].bytes;
+	ml += uploads[i].usecs;
+    }
+    mb /= n;
+    ml /= n;
+    for (int i = 0; i < n; i++) {
+	var += (uploads[i].bytes - mb) * (uploads[i].bytes - mb);
+	cov += (uploads[i].bytes - mb) * (uploads[i].usecs - ml);
+    }
+
+    /* usecs per byte, and fixed per-object latency. If all the
+     * objects were the same size we can't tell them apart, so
+     * split the difference.
+     */
+    double slope = (var > 0 && cov > 0) ? cov / var : ml / 2 / mb;
+    double l0 = std::max(ml - slope * mb, 0.0);
+
+    double denom = cfg->xlate_window - arrival_rate * slope;
+    double target = (denom <= 0) ? max : arrival_rate * l0 / denom;
+    target = std::clamp(target, (double)min, (double)max);
+
+    /* smooth it a bit, and round to 64KB
+     */
+    batch_bytes = round_up((size_t)(3 * batch_bytes + target) / 4, 65536);
+    batch_bytes = std::clamp(batch_bytes, min, max);
+    return batch_bytes;
+}
+
+void translate_impl::get_stats(xlate_stats *s) {
+    std::unique_lock lk(m);
+    int n = std::min(n_uploads, n_window);
+    s->objs_per_sec = 0;
+    if (n > 1) {
+	auto [t_min, t_max] = std::minmax_element(uploads.begin(), uploads.begin()+n,
+		    [](upload &a, upload &b){return a.done < b.done;});
+	auto usecs = std::chrono::duration<double,std::micro>(t_max->done -
+							     t_min->done).count();
+	if (usecs > 0)
+	    s->objs_per_sec = (n-1) * 1e6 / usecs;
+    }
+    s->batch_size = b->max;
+    s->objs_written = objs_written;
+    s->bytes_written = bytes_written;
+    for (int i = 0; i < 16; i++)
+	s->size_hist[i] = size_hist[i];
+    s->crc_checks = crc_checks;
+    s->crc_errors = crc_errors;
+    s->dedup_lookups = dedup_lookups;
+    s->dedup_hits = dedup_hits;
+    s->dedup_entries = dedup_index.size();
+    s->trimmed_sectors = trimmed_sectors;
+}
+
+/* check 1 in cfg->crc_verify object reads
+ */
+bool translate_impl::crc_sample(void) {
+    return cfg->crc_verify > 0 && crc_reads++ % cfg->crc_verify == 0;
+}
+
+/* check the data CRCs of @len bytes at byte @offset of object @obj,
+ * just read from the backend into @buf, for 1 in cfg->crc_verify
+ * reads or if @always. Returns false if corrupt.
+ */
+bool translate_impl::verify_read(int obj, size_t offset, const char *buf,
+				 size_t len, bool always) {
+    if (!always && !crc_sample())
+	return true;
+
+    std::unique_lock lk(crc_m);
+    if (crc_hdrs.find(obj) == crc_hdrs.end()) {
+	lk.unlock();
+	objname name(prefix(obj), obj);
+	char *hdr = parser->read_object_hdr(name.c_str(), false);
+	if (hdr == NULL)
+	    return true;	// e.g. deleted by GC since
+	lk.lock();
+	if (crc_hdrs.find(obj) != crc_hdrs.end())
+	    free(hdr);
+	else {
+	    crc_hdrs[obj] = hdr;
+	    crc_fifo.push_back(obj);
+	    if (crc_fifo.size() > crc_max_hdrs) {
+		free(crc_hdrs[crc_fifo.front()]);
+		crc_hdrs.erase(crc_fifo.front());
+		crc_fifo.pop_front();
+	    }
+	}
+    }
+
+    crc_checks++;
+    int bad = obj_check_crcs(crc_hdrs[obj], buf, offset, len);
+    if (bad == 0)
+	return true;
+    crc_errors += bad;
+    do_log("CRC error: obj %d offset %ld len %ld (%d chunks)\n", obj,
+	   offset, len, bad);
+    return false;
 }
 
-/* wake up every @wait_time, if data is pending in current batch
- * for @timeout then write it to backend
+/* read @len bytes at byte @offset of object @obj into @buf for
+ * copying elsewhere (repack, defrag, readv), always checking the
+ * CRCs; the CRC chunks touched are read in full. Returns 0 or -EIO.
+ */
+int translate_impl::read_checked(int obj, size_t offset, char *buf,
+				 size_t len) {
+    size_t base = offset - offset % LSVD_CRC_CHUNK,
+	limit = (offset + len + LSVD_CRC_CHUNK - 1) / LSVD_CRC_CHUNK *
+	LSVD_CRC_CHUNK;
+    char *tmp = (char*)aligned_alloc(512, limit - base);
+    objname name(prefix(obj), obj);
+    iovec iov = {tmp, limit - base};
+    int rv = 0;
+    if (objstore->read_object(name.c_str(), &iov, 1, base) <
+	(ssize_t)(offset + len - base) ||
+	!verify_read(obj, base, tmp, limit - base, true))
+	rv = -EIO;
+    else
+	memcpy(buf, tmp + (offset - base), len);
+    free(tmp);
+    return rv;
+}
+
+/* seal the current batch cfg->flush_msec after its first write, if it
+ * hasn't filled up before then. Sleeps until the first write to an
+ * empty batch, then until that batch's deadline.
  */
 void translate_impl::flush_thread(thread_pool<int> *p) {
     pthread_setname_np(pthread_self(), "flush_thread");
-    auto wait_time = std::chrono::milliseconds(500);
     auto timeout = std::chrono::milliseconds(cfg->flush_msec);
-    auto t0 = std::chrono::system_clock::now();
-    auto seq0 = seq.load();
+    std::unique_lock lk(m);
 
-    while (p->running) {
-	std::unique_lock lk(*p->m);
-	//std::unique_lock lk(m);
-	if (p->cv.wait_for(lk, wait_time, [p] {return !p->running;}))
-	    return;
-	if (p->running && seq0 == seq.load() && b->len > 0) {
-	    if (std::chrono::system_clock::now() - t0 > timeout) {
-		lk.unlock();
-		do_log("timed flush %d\n", seq0);
-		flush();
-	    }
+    while (p->running && !stopped) {
+	if (b->empty()) {
+	    flush_cv.wait(lk);
+	    continue;
 	}
-	else {
-	    seq0 = seq.load();
-	    t0 = std::chrono::system_clock::now();
+	auto deadline = b->first_write + timeout;
+	if (std::chrono::system_clock::now() < deadline) {
+	    flush_cv.wait_until(lk, deadline);
+	    continue;
 	}
+	do_log("timed flush %d\n", seq.load());
+	seal_batch();
     }
 }
 
@@ -627,28 +1827,37 @@ void translate_impl::flush_thread(thread_pool<int> *p) {
 
 void translate_impl::verify_live(void) {
     // std::unique_lock lk(*map_lock); <- must be held
+    if (!map_loaded)
+	return;
     int n = seq.load();
     std::vector<int> live(n*2, 0);
     for (auto it = map->begin(); it != map->end(); it++) {
 	auto [base, limit, ptr] = it->vals();
 	live[ptr.obj] += (limit - base);
     }
-    for (auto it = object_info.begin(); it != object_info.end(); it++) {
-	auto [obj, info] = *it;
-	if (info.type == LSVD_DATA)
-	    assert(info.live == live[obj]);
+    for (int obj = object_info.first(); obj < object_info.limit(); obj++) {
+	auto info = object_info.find(obj);
+	if (info && info->type == LSVD_DATA)
+	    assert(info->live == live[obj]);
     }
 }
 
 
 /* synchronously write a checkpoint
  * NOTE - this drops the lock passed to it.
+ * Returns false if the superblock wasn't updated to point to it
+ * (shutting down, or no room in the superblock)
  */
-void translate_impl::write_checkpoint(int ckpt_seq,
+bool translate_impl::write_checkpoint(int ckpt_seq,
 				      std::unique_lock<std::mutex> &lk) {
     std::vector<ckpt_mapentry> entries;
     std::vector<ckpt_obj> objects;
 
+    while (!map_loaded && !stopped)	// lazy open
+	shard_cv.wait(lk);
+    if (!map_loaded)
+	return false;
+
     /* - hold the translation layer lock (lk) until we get a copy 
      *   of object_info [no, wait until object map?]
      * - hold the map lock while we get a copy of the map.
@@ -656,18 +1865,23 @@ void translate_impl::write_checkpoint(int ckpt_seq,
     std::unique_lock objlock(*map_lock);
     verify_live();
 
-    for (auto it = map->begin(); it != map->end(); it++) {
-	auto [base, limit, ptr] = it->vals();
-	entries.push_back((ckpt_mapentry){.lba = base,
-		    .len = limit-base, .obj = (int32_t)ptr.obj,
-		    .offset = (int32_t)ptr.offset});
-    }
+    int n_shards = div_round_up(map->size(), cfg->ckpt_shard_entries);
+    if (n_shards <= 1)
+	for (auto it = map->begin(); it != map->end(); it++) {
+	    auto [base, limit, ptr] = it->vals();
+	    entries.push_back((ckpt_mapentry){.lba = base,
+			.len = limit-base, .obj = (int32_t)ptr.obj,
+			.offset = (int32_t)ptr.offset});
+	}
 
     size_t map_bytes = entries.size() * sizeof(ckpt_mapentry);
 
-    for (auto it = object_info.begin(); it != object_info.end(); it++) {
-	auto obj_num = it->first;
-	auto [hdr, data, live, type] = it->second;
+    for (int obj_num = object_info.first();
+	 obj_num < object_info.limit(); obj_num++) {
+	auto oi = object_info.find(obj_num);
+	if (oi == NULL)
+	    continue;
+	auto [hdr, data, live, type] = *oi;
 	if (type == LSVD_DATA)
 	    objects.push_back((ckpt_obj){.seq = (uint32_t)obj_num,
 			.hdr_sectors = (uint32_t)hdr,
@@ -676,58 +1890,122 @@ void translate_impl::write_checkpoint(int ckpt_seq,
     }
     objlock.unlock();
 
-    /* add object for this checkpoint
+    /* large maps get copied in equal LBA ranges on ckpt_threads
+     * threads, one per shard. Holding lk keeps anyone from updating
+     * the map in the meantime.
+     */
+    std::vector<ckpt_shard> shards;
+    std::vector<std::vector<ckpt_mapentry>> shard_maps;
+    if (n_shards > 1) {
+	int64_t vol_sectors = super_sh->vol_size;
+	shards.resize(n_shards);
+	shard_maps.resize(n_shards);
+	parallel_for(n_shards, cfg->ckpt_threads, [&](int i) {
+		int64_t base = vol_sectors * i / n_shards,
+		    limit = vol_sectors * (i+1) / n_shards;
+		std::shared_lock slk(*map_lock);
+		for (auto it = map->lookup(base);
+		     it != map->end() && it->base() < limit; it++) {
+		    auto [_base, _limit, ptr] = it->vals(base, limit);
+		    shard_maps[i].push_back((ckpt_mapentry){.lba = _base,
+				.len = _limit - _base, .obj = (int32_t)ptr.obj,
+				.offset = (int32_t)ptr.offset});
+		}
+		shards[i] = (ckpt_shard){.base = base, .limit = limit,
+			 .n_entries = (uint32_t)shard_maps[i].size()};
+	    });
+    }
+    size_t shards_bytes = shards.size() * sizeof(ckpt_shard);
+
+    std::vector<deferred_delete> deletes = deferred_deletes;
+
+    /* checkpoints aren't in object_info - nothing there would ever
+     * erase them, and only data objects are accounted or cleaned
      */
     size_t objs_bytes = objects.size() * sizeof(ckpt_obj);
+    size_t dels_bytes = deletes.size() * sizeof(deferred_delete);
     size_t hdr_bytes = sizeof(obj_hdr) + sizeof(obj_ckpt_hdr);
     int sectors = div_round_up(hdr_bytes + sizeof(ckpt_seq) + map_bytes +
-			       objs_bytes, 512);
-    object_info[ckpt_seq] = (obj_info){.hdr = sectors, .data = 0, .live = 0,
-				   .type = LSVD_CKPT};
+			       objs_bytes + dels_bytes + shards_bytes, 512);
     do_log("adding checkpoint: %d\n", ckpt_seq);
     checkpoints.push_back(ckpt_seq);
     
     /* wait until all prior objects have been acked by backend, 
      * then unlock
      */
-    while (next_compln < ckpt_seq && !stopped)
-	cv.wait(lk);
+    while (!completions.ready(ckpt_seq-1) && !stopped)
+	completions.wait(ckpt_seq-1, lk);
     if (stopped)
-	return;
+	return false;
     lk.unlock();
 
+    /* the shards go first, in parallel, so that the checkpoint is
+     * complete once the manifest is written.
+     */
+    parallel_for(n_shards > 1 ? n_shards : 0, cfg->ckpt_threads, [&](int i) {
+	    size_t bytes = shard_maps[i].size() * sizeof(ckpt_mapentry);
+	    int _sectors = div_round_up(hdr_bytes + bytes, 512);
+	    auto buf = (char*)calloc(_sectors * 512, 1);
+	    auto h = (obj_hdr*)buf;
+	    *h = (obj_hdr){.magic = LSVD_MAGIC, .version = LSVD_OBJ_VERSION,
+			   .vol_uuid = {0},
+			   .type = LSVD_CKPT, .seq = (uint32_t)ckpt_seq,
+			   .hdr_sectors = (uint32_t)_sectors, .data_sectors = 0};
+	    memcpy(h->vol_uuid, uuid, sizeof(uuid_t));
+	    auto ch = (obj_ckpt_hdr*)(h+1);
+	    *ch = (obj_ckpt_hdr){.cache_seq = ckpt_cache_seq,
+				 .ckpts_offset = 0, .ckpts_len = 0,
+				 .objs_offset = 0, .objs_len = 0,
+				 .deletes_offset = 0, .deletes_len = 0,
+				 .map_offset = (uint32_t)hdr_bytes,
+				 .map_len = (uint32_t)bytes,
+				 .shards_offset = 0, .shards_len = 0};
+	    memcpy(buf + hdr_bytes, shard_maps[i].data(), bytes);
+
+	    iovec iov = {buf, (size_t)_sectors * 512};
+	    objname name(prefix(ckpt_seq), ckpt_seq, i);
+	    objstore->write_object(name.c_str(), &iov, 1);
+	    free(buf);
+	});
+
     /* put it all together in memory
      */
     auto buf = (char*)calloc(hdr_bytes, 1);
     auto h = (obj_hdr*)buf;
-    *h = (obj_hdr){.magic = LSVD_MAGIC, .version = 1, .vol_uuid = {0},
+    *h = (obj_hdr){.magic = LSVD_MAGIC, .version = LSVD_OBJ_VERSION,
+		   .vol_uuid = {0},
 		   .type = LSVD_CKPT, .seq = (uint32_t)ckpt_seq,
 		   .hdr_sectors = (uint32_t)sectors, .data_sectors = 0};
     memcpy(h->vol_uuid, uuid, sizeof(uuid_t));
     auto ch = (obj_ckpt_hdr*)(h+1);
 
     uint32_t o1 = sizeof(obj_hdr)+sizeof(obj_ckpt_hdr), o2 = o1 + sizeof(ckpt_seq),
-	o3 = o2 + objs_bytes;
+	o3 = o2 + objs_bytes, o4 = o3 + dels_bytes, o5 = o4 + map_bytes;
     *ch = (obj_ckpt_hdr){.cache_seq = ckpt_cache_seq,
 			 .ckpts_offset = o1, .ckpts_len = sizeof(ckpt_seq),
 			 .objs_offset = o2, .objs_len = o3-o2,
-			 .deletes_offset = 0, .deletes_len = 0,
-			 .map_offset = o3, .map_len = (uint32_t)map_bytes};
-
-    size_t tail = sectors * 512 -
-	(hdr_bytes + sizeof(ckpt_seq) + objs_bytes + map_bytes);
+			 .deletes_offset = o3, .deletes_len = o4-o3,
+			 .map_offset = o4, .map_len = (uint32_t)map_bytes,
+			 .shards_offset = o5,
+			 .shards_len = (uint32_t)shards_bytes};
+
+    size_t tail = sectors * 512 - (hdr_bytes + sizeof(ckpt_seq) +
+				   objs_bytes + dels_bytes + map_bytes +
+				   shards_bytes);
     char tailbuf[512] = {0};
     
     iovec iov[] = {{.iov_base = buf, .iov_len = hdr_bytes},
 		   {.iov_base = (char*)&ckpt_seq, .iov_len = sizeof(ckpt_seq)},
 		   {.iov_base = (char*)objects.data(), .iov_len = objs_bytes},
+		   {.iov_base = (char*)deletes.data(), .iov_len = dels_bytes},
 		   {.iov_base = (char*)entries.data(), .iov_len = map_bytes},
+		   {.iov_base = (char*)shards.data(), .iov_len = shards_bytes},
 		   {.iov_base = tailbuf, .iov_len = tail}};
-    int niovs = (tail == 0) ? 4 : 5;
+    int niovs = (tail == 0) ? 6 : 7;
 
     /* and write it
      */
-    objname name(prefix(), ckpt_seq);
+    objname name(prefix(ckpt_seq), ckpt_seq);
     objstore->write_object(name.c_str(), iov, niovs);
     do_log("wrote ckpt %d\n", ckpt_seq);
     notify_complete(ckpt_seq);
@@ -735,32 +2013,90 @@ void translate_impl::write_checkpoint(int ckpt_seq,
     
     free(buf);
 
-    /* Now re-write the superblock with the new list of checkpoints
-     */
-    size_t offset = sizeof(*super_h) + sizeof(*super_sh);
-
     /* trim checkpoints. This function is the only place we modify
-     * checkpoints[]
+     * checkpoints[]. Snapshot checkpoints stay on the backend.
      */
+    std::vector<uint32_t> trimmed;
     std::vector<int> ckpts_to_delete;
     while (checkpoints.size() > 3) {
-	ckpts_to_delete.push_back(checkpoints.front());
+	if (!is_snap(checkpoints.front()) &&
+	    (int)checkpoints.front() > clone_seq())
+	    ckpts_to_delete.push_back(checkpoints.front());
+	trimmed.push_back(checkpoints.front());
 	checkpoints.erase(checkpoints.begin());
     }
 
-    if (checkpoints.size() > 3)
-	do_log("too many checkpoints: %d\n", checkpoints.size());
+    /* Now re-write the superblock with the new list of checkpoints.
+     * If that fails the old superblock still lists the trimmed
+     * ones, so put them back and delete nothing.
+     */
+    if (!write_super(lk)) {
+	checkpoints.insert(checkpoints.begin(), trimmed.begin(),
+			   trimmed.end());
+	do_log("ckpt %d: superblock not updated\n", ckpt_seq);
+	return false;
+    }
+    ckpt_durable = std::max(ckpt_durable, ckpt_seq);
+
+    lk.unlock();
+    for (auto c : ckpts_to_delete)
+	delete_ckpt(c);
+    lk.lock();
+    return true;
+}
+
+/* lay out the checkpoint and snapshot lists in the superblock and
+ * write it. Caller holds m (via @lk), which is dropped during the
+ * write. Returns false if we're shutting down, or if the lists don't
+ * fit in the 4KB superblock (snap_create and translate_clone_image
+ * leave room for 4 checkpoints, so they should).
+ */
+bool translate_impl::write_super(std::unique_lock<std::mutex> &lk) {
+    /* GC workers and the write path can both get here; only one
+     * of them at a time gets to update and write the superblock
+     */
+    while (super_busy && !stopped)
+	cv.wait(lk);
+    if (stopped)
+	return false;
+    if (super_bytes() > 4096) {
+	do_log("superblock overflow: %d bytes\n", (int)super_bytes());
+	return false;
+    }
 
     /* this is the only place we modify *super_sh
      */
+    size_t offset = sizeof(*super_h) + sizeof(*super_sh);
     super_sh->ckpts_offset = offset;
-    super_sh->ckpts_len = checkpoints.size() * sizeof(ckpt_seq);
+    super_sh->ckpts_len = checkpoints.size() * sizeof(uint32_t);
     auto pc = (uint32_t*)(super_buf + offset);
     for (size_t i = 0; i < checkpoints.size(); i++)
 	*pc++ = checkpoints[i];
+    offset += super_sh->ckpts_len;
+
+    super_sh->clones_offset = offset;
+    for (auto const &c : bases) {
+	auto ci = (clone_info*)(super_buf + offset);
+	memcpy(ci->vol_uuid, c.uuid, sizeof(uuid_t));
+	ci->sequence = c.seq;
+	ci->name_len = c.name.size();
+	memcpy(ci->name, c.name.data(), c.name.size());
+	offset += sizeof(clone_info) + c.name.size();
+    }
+    super_sh->clones_len = offset - super_sh->clones_offset;
+
+    super_sh->snaps_offset = offset;
+    for (auto const &s : snapshots) {
+	auto si = (snap_info*)(super_buf + offset);
+	si->seq = s.seq;
+	si->name_len = s.name.size();
+	memcpy(si->name, s.name.data(), s.name.size());
+	offset += sizeof(snap_info) + s.name.size();
+    }
+    super_sh->snaps_len = offset - super_sh->snaps_offset;
+    assert(offset == super_bytes());
 
-    if (stopped)
-	return;
+    super_busy = true;
     lk.unlock();
 
     struct iovec iov2 = {super_buf, 4096};
@@ -768,7 +2104,7 @@ void translate_impl::write_checkpoint(int ckpt_seq,
 	char buf[128], *p = buf;
 	for (auto const &c : checkpoints)
 	    p += sprintf(p, " %d", c);
-	auto _pc = (uint32_t*)(super_buf + offset);
+	auto _pc = (uint32_t*)(super_buf + super_sh->ckpts_offset);
 	p += sprintf(p, " [");
 	for (size_t i = 0; i < checkpoints.size(); i++)
 	    p += sprintf(p, " %d", _pc[i]);
@@ -779,87 +2115,616 @@ void translate_impl::write_checkpoint(int ckpt_seq,
     
     objstore->write_object(super_name, &iov2, 1);
     do_log("write done\n");
-    
-    for (auto c : ckpts_to_delete) {
-	objname name(prefix(), c);
-	do_log("ckpt delete %s\n", name.c_str());
-	objstore->delete_object(name.c_str());
-    }
+
     lk.lock();
+    super_busy = false;
+    cv.notify_all();
+    return true;
+}
+
+/* bytes of superblock in use, including the variable-length lists
+ */
+size_t translate_impl::super_bytes(void) {
+    size_t bytes = sizeof(obj_hdr) + sizeof(super_hdr) +
+	checkpoints.size() * sizeof(uint32_t);
+    for (auto const &c : bases)
+	bytes += sizeof(clone_info) + c.name.size();
+    for (auto const &s : snapshots)
+	bytes += sizeof(snap_info) + s.name.size();
+    return bytes;
+}
+
+void translate_impl::delete_ckpt(int ckpt) {
+    objname name(prefix(ckpt), ckpt);
+    do_log("ckpt delete %s\n", name.c_str());
+    objstore->delete_object(name.c_str());
+    for (int i = 0; ; i++) {	// shards, if any
+	objname shard(prefix(ckpt), ckpt, i);
+	if (objstore->delete_object(shard.c_str()) < 0)
+	    break;
+    }
 }
 
 int translate_impl::checkpoint(void) {
     std::unique_lock lk(m);
-    if (b->len > 0) {
-	b->seq = seq++;
-	auto tmp = b;
-	b = new batch(cfg->batch_size);
-	process_batch(tmp);
-    }
+    seal_batch();
     int _seq = seq++;
-    write_checkpoint(_seq, lk);
+    if (!write_checkpoint(_seq, lk))
+	return -EIO;
     return _seq;
 }
 
+/* -------------- Snapshots -------------- */
 
-/* -------------- Garbage collection ---------------- */
-
-/* Needs a lot of work. Note that all reads/writes are synchronous
- * for now...
+/* clones of the snapshot with checkpoint @seq in image @image are
+ * listed, one name per line, in object "<image>.clones.<seq>".
+ * The parent never writes it, so it's safe to update offline.
  */
-void translate_impl::do_gc(std::unique_lock<std::mutex> &lk,
-			   bool *running) {
-    gc_cycles++;
-    int max_obj = seq.load();
-
-    /* create list of object info in increasing order of 
-     * utilization, i.e. (live data) / (total size)
-     */
-    std::set<std::tuple<double,int,int>> utilization;
-
-    for (auto p : object_info)  {
-	auto [hdrlen, datalen, live, type] = p.second;
-	if (type != LSVD_DATA)
-	    continue;
-	double rho = 1.0 * live / datalen;
-	sector_t sectors = hdrlen + datalen;
-	utilization.insert(std::make_tuple(rho, p.first, sectors));
-	assert(sectors <= 20*1024*1024/512);
-    }
+static std::string clone_list_name(const char *image, int seq) {
+    char tmp[32];
+    sprintf(tmp, ".clones.%08x", seq);
+    return std::string(image) + tmp;
+}
 
-    /* gather list of objects needing cleaning, return if none
-     */
-    const double threshold = 0.50;
-    std::vector<std::pair<int,int>> objs_to_clean;
-    for (auto [u, o, n] : utilization) {
-	if (u > threshold)
-	    break;
-	if (objs_to_clean.size() > 32)
+static void read_clone_list(backend *objstore, const char *image, int seq,
+			    std::vector<std::string> &names) {
+    names.clear();
+    size_t max = 64*1024;
+    std::vector<char> buf(max);
+    iovec iov = {buf.data(), max};
+    int n = objstore->read_object(clone_list_name(image, seq).c_str(),
+				  &iov, 1, 0);
+    for (char *p = buf.data(), *end = p + std::max(n, 0); p < end; ) {
+	char *nl = (char*)memchr(p, '\n', end - p);
+	if (nl == NULL)
 	    break;
-	objs_to_clean.push_back(std::make_pair(o, n));
+	names.push_back(std::string(p, nl - p));
+	p = nl + 1;
     }
-    if (objs_to_clean.size() == 0) 
-	return;
-	
-    /* find all live extents in objects listed in objs_to_clean:
-     * - make bitmap from objs_to_clean
-     * - find all entries in map pointing to those objects
-     */
-    std::vector<bool> bitmap(max_obj+1);
-    for (auto it = objs_to_clean.begin(); it != objs_to_clean.end(); it++)
-	bitmap[it->first] = true;
+}
 
-    std::unique_lock objlock(*map_lock); // TODO: might not need til later...
-    extmap::objmap live_extents;
-    for (auto it = map->begin(); it != map->end(); it++) {
-	auto [base, limit, ptr] = it->vals();
-	if (bitmap[ptr.obj])
-	    live_extents.update(base, limit, ptr);
-    }
-    objlock.unlock();
-    lk.unlock();
+static int write_clone_list(backend *objstore, const char *image, int seq,
+			    std::vector<std::string> &names) {
+    auto name = clone_list_name(image, seq);
+    if (names.size() == 0)
+	return objstore->delete_object(name.c_str());
+    std::string data;
+    for (auto const &n : names)
+	data += n + "\n";
+    iovec iov = {(char*)data.data(), data.size()};
+    return objstore->write_object(name.c_str(), &iov, 1);
+}
 
-    /* everything before this point was in-memory only, with the 
+bool translate_impl::is_snap(int ckpt) {
+    for (auto const &s : snapshots)
+	if (s.seq == ckpt)
+	    return true;
+    return false;
+}
+
+/* write a checkpoint and keep it. The objects its map points to are
+ * exactly the data objects with live sectors, so pin those; we hold
+ * m from here until write_checkpoint has copied the map, so they
+ * agree. A GC worker may already be copying one of them out; it
+ * checks for pins before freeing anything (see gc_clean)
+ * This is not O(1): it walks the object table and writes a full
+ * checkpoint, so it costs O(map) time and checkpoint space.
+ */
+int translate_impl::snap_create(const char *name) {
+    std::unique_lock lk(m);
+    size_t len = strlen(name);
+    if (len == 0 || len > 255)
+	return -EINVAL;
+
+    for (auto const &s : snapshots)
+	if (s.name == name)
+	    return -EEXIST;
+    size_t bytes = super_bytes() + sizeof(uint32_t) + // its checkpoint
+	sizeof(snap_info) + len;
+    if (bytes > 4096)		// has to fit in the superblock
+	return -ENOSPC;
+
+    while (!map_loaded && !stopped)	// lazy open
+	shard_cv.wait(lk);
+    if (stopped)
+	return -EIO;
+
+    seal_batch();
+    snapshot snap = {seq++, name, {}};
+    for (int obj = object_info.first(); obj < object_info.limit(); obj++) {
+	auto oi = object_info.find(obj);
+	if (oi != NULL && oi->type == LSVD_DATA && oi->live > 0) {
+	    object_info.snap_ref(obj, 1);
+	    snap.objs.push_back(obj);
+	}
+    }
+    snapshots.push_back(snap);
+    do_log("snapshot %s: ckpt %d, %d objects\n", name, snap.seq,
+	   (int)snap.objs.size());
+    if (!write_checkpoint(snap.seq, lk)) {
+	/* not in the superblock, so it's just another checkpoint
+	 */
+	auto it = std::find_if(snapshots.begin(), snapshots.end(),
+			       [&](snapshot &s){return s.seq == snap.seq;});
+	for (auto obj : it->objs)
+	    if (object_info.find(obj) != NULL)
+		object_info.snap_ref(obj, -1);
+	snapshots.erase(it);
+	return -EIO;
+    }
+    return 0;
+}
+
+/* drop the pins, take it out of the superblock, then delete its
+ * checkpoint unless it's one of the current ones. Objects it was
+ * holding up are freed by GC in the usual way. Snapshots with clones
+ * can't be removed.
+ */
+int translate_impl::snap_remove(const char *name) {
+    std::unique_lock lk(m);
+    auto it = std::find_if(snapshots.begin(), snapshots.end(),
+			   [&](snapshot &s){return s.name == name;});
+    if (it == snapshots.end())
+	return -ENOENT;
+
+    int snap_seq = it->seq;
+    lk.unlock();
+    std::vector<std::string> clones;
+    read_clone_list(objstore, super_name, snap_seq, clones);
+    if (clones.size() > 0)
+	return -EBUSY;
+    lk.lock();
+    it = std::find_if(snapshots.begin(), snapshots.end(),
+		      [&](snapshot &s){return s.name == name;});
+    if (it == snapshots.end())
+	return -ENOENT;
+
+    for (auto obj : it->objs)
+	object_info.snap_ref(obj, -1);
+    int ckpt = it->seq;
+    snapshots.erase(it);
+    bool current = std::find(checkpoints.begin(), checkpoints.end(),
+			     ckpt) != checkpoints.end();
+    if (!write_super(lk))
+	return -EIO;
+    lk.unlock();
+    if (!current)
+	delete_ckpt(ckpt);
+    return 0;
+}
+
+/* replace the map with the snapshot's, and write a checkpoint so it
+ * sticks; the rollback happens when the superblock points to that
+ * checkpoint, so a crash before then leaves the volume as it was.
+ * Anything written since the snapshot - including the open batch -
+ * is dropped, and all of the objects the snapshot map points to are
+ * still here, since they're pinned. The caller has flushed the write
+ * cache and invalidated it, so none of it is replayed or read later.
+ * If the checkpoint can't be written we put the old map back.
+ */
+int translate_impl::snap_rollback(const char *name) {
+    std::unique_lock lk(m);
+    auto it = std::find_if(snapshots.begin(), snapshots.end(),
+			   [&](snapshot &s){return s.name == name;});
+    if (it == snapshots.end())
+	return -ENOENT;
+    int ckpt = it->seq;
+
+    while (!map_loaded && !stopped)	// lazy open
+	shard_cv.wait(lk);
+    if (stopped)
+	return -EIO;
+    lk.unlock();
+
+    uint64_t _cache_seq;
+    std::vector<uint32_t> _ckpts;
+    std::vector<ckpt_obj> _objects;
+    std::vector<deferred_delete> _deletes;
+    std::vector<ckpt_mapentry> entries;
+    objname ckpt_name(prefix(ckpt), ckpt);
+    if (parser->read_checkpoint(ckpt_name.c_str(), _cache_seq, _ckpts,
+				_objects, _deletes, entries) < 0)
+	return -EIO;
+
+    /* GC or defrag working from the old map could free objects the
+     * old map needs, if we have to put it back
+     */
+    lk.lock();
+    gc_paused = true;
+    while (gc_running > 0)
+	gc_cv.wait(lk);
+    seal_batch();
+    {
+	std::unique_lock lk2(bufmap_m);
+	bufmap.reset();
+    }
+
+    auto set_map = [&](std::vector<ckpt_mapentry> &_entries) {
+	std::map<int,int> live;
+	map->reset();
+	for (auto e : _entries) {
+	    map->update(e.lba, e.lba + e.len,
+			(extmap::obj_offset){.obj = e.obj, .offset = e.offset});
+	    live[e.obj] += e.len;
+	}
+	total_live_sectors = 0;
+	for (int obj = object_info.first(); obj < object_info.limit(); obj++) {
+	    auto oi = object_info.find(obj);
+	    if (oi == NULL || oi->type != LSVD_DATA)
+		continue;
+	    object_info.add_live(obj, live[obj] - oi->live);
+	    total_live_sectors += live[obj];
+	}
+	verify_live();
+    };
+
+    std::unique_lock objlock(*map_lock);
+    std::vector<ckpt_mapentry> current;
+    for (auto it = map->begin(); it != map->end(); it++) {
+	auto [base, limit, ptr] = it->vals();
+	current.push_back((ckpt_mapentry){.lba = base, .len = limit-base,
+		    .obj = (int32_t)ptr.obj, .offset = (int32_t)ptr.offset});
+    }
+    set_map(entries);
+    objlock.unlock();
+
+    do_log("rollback to %s: ckpt %d, %d entries\n", name, ckpt,
+	   (int)entries.size());
+    auto _cache_seq0 = ckpt_cache_seq;
+    ckpt_cache_seq = last_cache_seq + 1;
+    int _seq = seq++;
+    bool ok = write_checkpoint(_seq, lk);
+    if (!ok) {
+	objlock.lock();
+	set_map(current);
+	objlock.unlock();
+	ckpt_cache_seq = _cache_seq0;
+    }
+    gc_paused = false;
+    return ok ? 0 : -EIO;
+}
+
+void translate_impl::snap_list(std::vector<std::pair<int,std::string>> &snaps) {
+    std::unique_lock lk(m);
+    for (auto const &s : snapshots)
+	snaps.push_back(std::make_pair(s.seq, s.name));
+}
+
+/* -------------- Map queries -------------- */
+
+/* (base, limit, exists) in sectors, sorted; merge adjacent extents
+ * and hand them to the caller. The map lock isn't held, since @cb
+ * may well read the volume.
+ */
+static int report_extents(std::vector<std::tuple<int64_t,int64_t,int>> &v,
+			  int (*cb)(uint64_t, size_t, int, void*), void *arg) {
+    std::sort(v.begin(), v.end());
+    for (size_t i = 0; i < v.size(); ) {
+	auto [base, limit, exists] = v[i++];
+	for (; i < v.size() && std::get<0>(v[i]) == limit &&
+		 std::get<2>(v[i]) == exists; i++)
+	    limit = std::get<1>(v[i]);
+	int rv = cb(base*512, (limit-base)*512, exists, arg);
+	if (rv < 0)
+	    return rv;
+    }
+    return 0;
+}
+
+/* objects are numbered in write order, so @since selects data
+ * written after it - except that a dedup hit points at an older
+ * object, so with dedup on that takes a snapshot (diff_iterate).
+ * Data moved by GC or defrag counts as new.
+ */
+int translate_impl::map_iterate(int since, uint64_t offset, uint64_t len,
+				int (*cb)(uint64_t, size_t, int, void*),
+				void *arg) {
+    if (since > 0 && cfg->dedup_blocks > 0)
+	return -ENOTSUP;
+    load_map(offset, len);	// lazy open
+    int64_t base = offset/512, limit = (offset + len)/512;
+    std::vector<std::tuple<int64_t,int64_t,int>> extents;
+
+    std::shared_lock lk(*map_lock);
+    for (auto it = map->lookup(base);
+	 it != map->end() && it->base() < limit; it++) {
+	auto [_base, _limit, ptr] = it->vals(base, limit);
+	if ((int)ptr.obj > since)
+	    extents.push_back(std::make_tuple(_base, _limit, 1));
+    }
+    lk.unlock();
+    return report_extents(extents, cb, arg);
+}
+
+/* compare the map to the snapshot's. Objects the snapshot points to
+ * are pinned, so unchanged data still maps to the same place; data
+ * moved by defrag (which doesn't know about pins) counts as changed.
+ */
+int translate_impl::diff_iterate(const char *name, uint64_t offset,
+				 uint64_t len,
+				 int (*cb)(uint64_t, size_t, int, void*),
+				 void *arg) {
+    std::unique_lock lk(m);
+    auto it = std::find_if(snapshots.begin(), snapshots.end(),
+			   [&](snapshot &s){return s.name == name;});
+    if (it == snapshots.end())
+	return -ENOENT;
+    int ckpt = it->seq;
+    lk.unlock();
+
+    uint64_t _cache_seq;
+    std::vector<uint32_t> _ckpts;
+    std::vector<ckpt_obj> _objects;
+    std::vector<deferred_delete> _deletes;
+    std::vector<ckpt_mapentry> entries;
+    objname ckpt_name(prefix(ckpt), ckpt);
+    if (parser->read_checkpoint(ckpt_name.c_str(), _cache_seq, _ckpts,
+				_objects, _deletes, entries) < 0)
+	return -EIO;
+
+    int64_t base = offset/512, limit = (offset + len)/512;
+    extmap::objmap snap_map;
+    for (auto e : entries)
+	if ((int64_t)e.lba < limit && (int64_t)(e.lba + e.len) > base)
+	    snap_map.update(std::max((int64_t)e.lba, base),
+			    std::min((int64_t)(e.lba + e.len), limit),
+			    (extmap::obj_offset){.obj = e.obj,
+				    .offset = (int64_t)e.offset +
+				    std::max(base - (int64_t)e.lba, (int64_t)0)});
+
+    /* changed: the current map, less anything pointing to the same
+     * place as the snapshot. discarded: holes under snapshot extents
+     */
+    load_map(offset, len);
+    extmap::objmap changed;
+    std::vector<std::tuple<int64_t,int64_t,int>> extents;
+    std::shared_lock lk2(*map_lock);
+    for (auto it = map->lookup(base);
+	 it != map->end() && it->base() < limit; it++) {
+	auto [_base, _limit, ptr] = it->vals(base, limit);
+	changed.update(_base, _limit, ptr);
+    }
+    for (auto it = snap_map.begin(); it != snap_map.end(); it++) {
+	auto [s_base, s_limit, s_ptr] = it->vals();
+	int64_t pos = s_base;
+	for (auto it2 = map->lookup(s_base);
+	     it2 != map->end() && it2->base() < s_limit; it2++) {
+	    auto [_base, _limit, ptr] = it2->vals(s_base, s_limit);
+	    if (_base > pos)
+		extents.push_back(std::make_tuple(pos, _base, 0));
+	    pos = _limit;
+	    extmap::obj_offset s_oo = {s_ptr.obj,
+				       s_ptr.offset + (_base - s_base)};
+	    if (ptr.obj == s_oo.obj && ptr.offset == s_oo.offset)
+		changed.trim(_base, _limit);
+	}
+	if (pos < s_limit)
+	    extents.push_back(std::make_tuple(pos, s_limit, 0));
+    }
+    lk2.unlock();
+
+    for (auto it = changed.begin(); it != changed.end(); it++)
+	extents.push_back(std::make_tuple(it->base(), it->limit(), 1));
+    return report_extents(extents, cb, arg);
+}
+
+/* save the map, object table and pending deletes to the cache file
+ * at clean close (after checkpoint()), so the next open on this host
+ * can skip fetching the checkpoint. Only valid if nothing has been
+ * written since the last checkpoint.
+ */
+int translate_impl::write_map_snapshot(void) {
+    if (snap_fd < 0 || snap_blocks < 2)
+	return -1;
+    std::unique_lock lk(m);
+    int last_ckpt = checkpoints.empty() ? -1 : checkpoints.back();
+    if (!map_loaded || last_ckpt < 0 || !b->empty() ||
+	seq != last_ckpt + 1 || ckpt_durable != last_ckpt) {
+	do_log("map snapshot: not at a checkpoint\n");
+	return -1;
+    }
+
+    std::vector<ckpt_obj> objects;
+    for (int obj_num = object_info.first();
+	 obj_num < object_info.limit(); obj_num++) {
+	auto oi = object_info.find(obj_num);
+	if (oi == NULL || oi->type != LSVD_DATA)
+	    continue;
+	objects.push_back((ckpt_obj){.seq = (uint32_t)obj_num,
+		    .hdr_sectors = (uint32_t)oi->hdr,
+		    .data_sectors = (uint32_t)oi->data,
+		    .live_sectors = (uint32_t)oi->live});
+    }
+    size_t objs_bytes = objects.size() * sizeof(ckpt_obj);
+    size_t dels_bytes = deferred_deletes.size() * sizeof(deferred_delete);
+    size_t map_bytes = map->size() * sizeof(ckpt_mapentry);
+    int blocks = 1 + div_round_up(objs_bytes + dels_bytes + map_bytes, 4096);
+    if (blocks > snap_blocks) {
+	do_log("map snapshot: %d blocks, room for %d\n", blocks, snap_blocks);
+	return -1;
+    }
+
+    auto buf = (char*)aligned_alloc(4096, blocks * 4096L);
+    memset(buf, 0, blocks * 4096L);
+    uint32_t o1 = 4096, o2 = o1 + objs_bytes, o3 = o2 + dels_bytes;
+    memcpy(buf + o1, objects.data(), objs_bytes);
+    memcpy(buf + o2, deferred_deletes.data(), dels_bytes);
+    {
+	std::shared_lock slk(*map_lock);
+	auto e = (ckpt_mapentry*)(buf + o3);
+	for (auto it = map->begin(); it != map->end(); it++, e++) {
+	    auto [base, limit, ptr] = it->vals();
+	    *e = (ckpt_mapentry){.lba = base, .len = limit-base,
+				 .obj = (int32_t)ptr.obj,
+				 .offset = (int32_t)ptr.offset};
+	}
+    }
+    auto sh = (j_map_snap*)buf;
+    *sh = (j_map_snap){.magic = LSVD_MAGIC, .type = LSVD_J_MAP_SNAP,
+		       .version = 1, .vol_uuid = {0},
+		       .ckpt = (uint32_t)last_ckpt,
+		       .cache_seq = ckpt_cache_seq, .blocks = blocks,
+		       .crc32 = crc32c(0, buf + 4096, (blocks-1) * 4096L),
+		       .objs_offset = o1, .objs_len = (uint32_t)objs_bytes,
+		       .deletes_offset = o2, .deletes_len = (uint32_t)dels_bytes,
+		       .map_offset = o3, .map_len = (uint32_t)map_bytes};
+    memcpy(sh->vol_uuid, uuid, sizeof(uuid_t));
+    lk.unlock();
+
+    /* data first, then the header block that makes it valid
+     */
+    int rv = -1;
+    if (pwrite(snap_fd, buf + 4096, (blocks-1) * 4096L,
+	       (snap_base + 1) * 4096L) >= 0 && fdatasync(snap_fd) == 0 &&
+	pwrite(snap_fd, buf, 4096, snap_base * 4096L) >= 0 &&
+	fdatasync(snap_fd) == 0)
+	rv = 0;
+    do_log("map snapshot: ckpt %d, %d blocks, rv %d\n", sh->ckpt, blocks, rv);
+    free(buf);
+    return rv;
+}
+
+/* at open: if the snapshot matches @ckpt (the newest checkpoint in the
+ * superblock), use it instead of reading the checkpoint
+ */
+bool translate_impl::read_map_snapshot(int ckpt, std::vector<ckpt_obj> &objects,
+				       std::vector<deferred_delete> &deletes,
+				       std::vector<ckpt_mapentry> &entries) {
+    if (snap_fd < 0 || snap_blocks < 2)
+	return false;
+    auto hdr = (char*)aligned_alloc(4096, 4096);
+    auto sh = (j_map_snap*)hdr;
+    char *buf = NULL;
+    bool ok = false;
+    
+    if (pread(snap_fd, hdr, 4096, snap_base * 4096L) < 0 ||
+	sh->magic != LSVD_MAGIC || sh->type != LSVD_J_MAP_SNAP ||
+	sh->version != 1 || memcmp(sh->vol_uuid, uuid, sizeof(uuid_t)) ||
+	sh->ckpt != (uint32_t)ckpt || sh->blocks < 1 ||
+	sh->blocks > snap_blocks)
+	goto out;
+    buf = (char*)aligned_alloc(4096, sh->blocks * 4096L);
+    memcpy(buf, hdr, 4096);
+    if (sh->blocks > 1 &&
+	pread(snap_fd, buf + 4096, (sh->blocks-1) * 4096L,
+	      (snap_base + 1) * 4096L) < 0)
+	goto out;
+    if (sh->crc32 != crc32c(0, buf + 4096, (sh->blocks-1) * 4096L)) {
+	do_log("map snapshot: bad CRC\n");
+	goto out;
+    }
+    max_cache_seq = sh->cache_seq;
+    decode_offset_len<ckpt_obj>(buf, sh->objs_offset, sh->objs_len, objects);
+    decode_offset_len<deferred_delete>(buf, sh->deletes_offset,
+				       sh->deletes_len, deletes);
+    decode_offset_len<ckpt_mapentry>(buf, sh->map_offset,
+				     sh->map_len, entries);
+    do_log("map snapshot: ckpt %d, %d entries\n", ckpt, (int)entries.size());
+    ok = true;
+
+out:
+    free(hdr);
+    if (buf)
+	free(buf);
+    return ok;
+}
+
+
+/* -------------- Garbage collection ---------------- */
+
+/* Needs a lot of work. Note that all reads/writes are synchronous
+ * for now...
+ */
+void translate_impl::do_gc(std::unique_lock<std::mutex> &lk,
+			   bool *running) {
+    gc_cycles++;
+
+    /* gather list of objects needing cleaning, in (roughly)
+     * increasing order of utilization; return if none. Objects still
+     * being written can't be read yet, so they wait for the next pass.
+     */
+    const double threshold = 0.50;
+    std::vector<std::pair<int,int>> objs_to_clean;
+    object_info.get_victims(threshold, 33, objs_to_clean);
+    objs_to_clean.erase(
+	std::remove_if(objs_to_clean.begin(), objs_to_clean.end(),
+		       [&](auto v) {return dedup_pins.count(v.first) > 0 ||
+				    !completions.ready(v.first);}),
+	objs_to_clean.end());
+    if (objs_to_clean.size() == 0) 
+	return;
+    for (auto const &v : objs_to_clean)
+	object_info.set_busy(v.first, true);
+
+    gc_clean(objs_to_clean, lk);
+}
+
+/* timed flushes (and hard_sync) produce lots of tiny objects which
+ * are 100% live, so utilization-based GC never touches them. Look
+ * for a run of consecutive undersized objects and rewrite their
+ * contents into full-size ones. Only completed objects are candidates.
+ */
+void translate_impl::do_compact(std::unique_lock<std::mutex> &lk,
+				bool *running) {
+    sector_t small = cfg->compact_obj_size / 512;
+    std::vector<std::pair<int,int>> run;
+
+    for (int obj = object_info.first(); completions.ready(obj); obj++) {
+	auto oi = object_info.find(obj);
+	if (oi == NULL || oi->type != LSVD_DATA) // gaps (ckpts) don't break a run
+	    continue;
+	if (oi->data < (int)small && !object_info.busy(obj) &&
+	    !object_info.pinned(obj) &&
+	    dedup_pins.find(obj) == dedup_pins.end()) {
+	    run.push_back(std::make_pair(obj, oi->hdr + oi->data));
+	    if ((int)run.size() >= cfg->compact_max_objs)
+		break;
+	}
+	else if ((int)run.size() >= cfg->compact_min_objs)
+	    break;
+	else
+	    run.clear();
+    }
+    if (run.size() == 0 || (int)run.size() < cfg->compact_min_objs)
+	return;
+
+    compact_cycles++;
+    compact_objs += run.size();
+    for (auto const &v : run)
+	object_info.set_busy(v.first, true);
+    do_log("compact %d objects: %d..%d\n", (int)run.size(),
+	   run.front().first, run.back().first);
+    gc_clean(run, lk);
+}
+
+/* copy live data out of @objs_to_clean (obj#, total sectors) into new
+ * objects, write a checkpoint, then delete the old objects.
+ * called and returns with @lk held, but drops it while doing I/O
+ */
+void translate_impl::gc_clean(std::vector<std::pair<int,int>> &objs_to_clean,
+			      std::unique_lock<std::mutex> &lk) {
+    int max_obj = seq.load();
+
+    /* find all live extents in objects listed in objs_to_clean:
+     * - make bitmap from objs_to_clean
+     * - find all entries in map pointing to those objects
+     */
+    std::vector<bool> bitmap(max_obj+1);
+    for (auto it = objs_to_clean.begin(); it != objs_to_clean.end(); it++)
+	bitmap[it->first] = true;
+
+    std::unique_lock objlock(*map_lock); // TODO: might not need til later...
+    extmap::objmap live_extents;
+    for (auto it = map->begin(); it != map->end(); it++) {
+	auto [base, limit, ptr] = it->vals();
+	if (bitmap[ptr.obj])
+	    live_extents.update(base, limit, ptr);
+    }
+    objlock.unlock();
+    lk.unlock();
+    std::set<int> corrupt;
+
+    /* everything before this point was in-memory only, with the 
      * translation instance mutex held, doing no I/O.
      */
 
@@ -878,13 +2743,33 @@ void translate_impl::do_gc(std::unique_lock<std::mutex> &lk,
 	 */
 	extmap::cachemap file_map;
 	sector_t offset = 0;
-	char *buf = (char*)malloc(20*1024*1024);
+	int max_sectors = 0;	// objects can be up to batch_max + headers
+	for (auto [i,sectors] : objs_to_clean)
+	    max_sectors = std::max(max_sectors, sectors);
+	char *buf = (char*)malloc(max_sectors * 512L);
 
 	for (auto [i,sectors] : objs_to_clean) {
-	    objname name(prefix(), i);
+	    objname name(prefix(i), i);
 	    iovec iov = {buf, (size_t)(sectors*512)};
-	    objstore->read_object(name.c_str(), &iov, 1, /*offset=*/ 0);
+	    if (objstore->read_object(name.c_str(), &iov, 1, /*offset=*/ 0) <
+		(ssize_t)(sectors*512L)) {
+		do_log("GC: can't read obj %d\n", i);
+		corrupt.insert(i);	// else we'd copy the last one's data
+		continue;
+	    }
 	    gc_sectors_read += sectors;
+
+	    /* don't copy corrupt data into a new object with good CRCs,
+	     * so always check here
+	     */
+	    crc_checks++;
+	    int n = obj_check_crcs(buf, buf, 0, sectors*512L);
+	    if (n > 0) {
+		crc_errors += n;
+		do_log("CRC error: GC obj %d (%d chunks)\n", i, n);
+		corrupt.insert(i);
+		continue;
+	    }
 	    extmap::obj_offset _base = {i, 0}, _limit = {i, sectors};
 	    file_map.update(_base, _limit, offset);
 	    if (write(fd, buf, sectors*512) < 0)
@@ -893,170 +2778,253 @@ void translate_impl::do_gc(std::unique_lock<std::mutex> &lk,
 	}
 	free(buf);
 
-	struct _extent {
-	    int64_t base;
-	    int64_t limit;
-	    extmap::obj_offset ptr;
-	};
-	std::vector<_extent> all_extents;
+	std::vector<gc_extent> all_extents;
 	for (auto it = live_extents.begin(); it != live_extents.end(); it++) {
 	    auto [base, limit, ptr] = it->vals();
-	    all_extents.push_back((_extent){base, limit, ptr});
-	}
-	
-	while (all_extents.size() > 0) {
-	    sector_t sectors = 0, max = 16 * 1024; // 8MB
-	    char *hdr = (char*)malloc(1024*32);	// 8MB / 4KB = 2K extents = 16KB
-
-	    auto it = all_extents.begin();
-	    while (it != all_extents.end() && sectors < max) {
-		auto [base, limit, ptr] = *it++;
-		sectors += (limit - base);
-		(void)ptr;	// suppress warning
-	    }
-	    std::vector<_extent> extents(std::make_move_iterator(all_extents.begin()),
-					 std::make_move_iterator(it));
-	    all_extents.erase(all_extents.begin(), it);
-	    
-	    /* lock the map while we read from the file. 
-	     * TODO: read everything in, put it in a bufmap, and then go 
-	     * back and construct an iovec for the subset that's still valid.
-	     */
-	    char *buf = (char*)aligned_alloc(512, sectors * 512);
-
-	    std::unique_lock lk2(m);
-	    std::unique_lock objlock2(*map_lock);
-
-	    off_t byte_offset = 0;
-	    sector_t data_sectors = 0;
-	    std::vector<data_map> obj_extents;
-
-	    /* the extents may have been fragmented in the meantime...
-	     */
-	    for (auto [base, limit, ptr] : extents) {
-		for (auto it2 = map->lookup(base);
-		     it2->base() < limit && it2 != map->end(); it2++) {
-		     /* [_base,_limit] is a piece of the extent
-		      * obj_base is where that piece starts in the object
-		      */
-		    auto [_base, _limit, obj_base] = it2->vals(base, limit);
-
-		    /* skip if it's not still in the object, otherwise
-		     * _obj_limit is where it ends.
-		     */
-		    if (obj_base.obj != ptr.obj)
-			continue;
-		    sector_t _sectors = _limit - _base;
-		    auto obj_limit =
-			extmap::obj_offset{obj_base.obj,
-					   obj_base.offset+_sectors};
-
-		    /* file_sector is where that piece starts in 
-		     * the GC file...
-		     */
-		    auto it3 = file_map.lookup(obj_base);
-		    auto [file_base,file_limit,file_sector] =
-			it3->vals(obj_base, obj_limit);
-		    (void)file_limit; // suppress warning
-		    (void)file_base;  // suppress warning
-
-		    size_t bytes = _sectors*512;
-		    auto err = pread(fd, buf+byte_offset, bytes, file_sector*512);
-		    assert(err == (ssize_t)bytes);
-#if 0
-		    /* debug testing, with stamped sectors only */
-		    for (int i = 0; i < (_limit - _base); i++) 
-			assert(*(int*)(buf+byte_offset+i*512) == _base+i);
-#endif
-
-		    obj_extents.push_back((data_map){(uint64_t)_base, (uint64_t)_sectors});
-
-		    data_sectors += _sectors;
-		    byte_offset += bytes;
-		}
-	    }
-	    int32_t _seq = seq++;	    
-
-	    gc_sectors_written += data_sectors;
-	    int hdr_sectors = make_gc_hdr(hdr, _seq, data_sectors,
-					  obj_extents.data(), obj_extents.size());
-	    auto offset = hdr_sectors;
-
-	    int gc_sectors = byte_offset / 512;
-	    obj_info oi = {.hdr = hdr_sectors, .data = gc_sectors,
-		   .live = gc_sectors, .type = LSVD_DATA};
-	    object_info[_seq] = oi;
-
-	    std::vector<extmap::lba2obj> deleted;
-	    for (auto e : obj_extents) {
-		extmap::obj_offset oo = {_seq, offset};
-		map->update(e.lba, e.lba+e.len, oo, &deleted);
-		offset += e.len;
-	    }
-	    for (auto d : deleted) {
-		auto [base, limit, ptr] = d.vals();
-		assert(object_info.find(ptr.obj) != object_info.end());
-		object_info[ptr.obj].live -= (limit - base);
-		assert(object_info[ptr.obj].live >= 0);
-		total_live_sectors -= (limit - base);
-	    }
-	    verify_live();
-	    objlock2.unlock();
-	    lk2.unlock();
-
-	    smartiov iovs;
-	    iovs.push_back((iovec){hdr, (size_t)hdr_sectors*512});
-	    iovs.push_back((iovec){buf, (size_t)byte_offset});
-
-	    auto t_req = new translate_req(_seq, this);
-	    t_req->to_free.push_back(hdr);
-	    t_req->to_free.push_back(buf);
-
-	    if (stopped)
-		return;
-	    
-	    objname name(prefix(), _seq);
-	    auto [iov,iovcnt] = iovs.c_iov();
-	    auto req = objstore->make_write_req(name.c_str(), iov, iovcnt);
-	    req->run(t_req);
-	    do_log("gc write %s\n", name.c_str());
+	    if (corrupt.find(ptr.obj) == corrupt.end())
+		all_extents.push_back((gc_extent){base, limit, ptr});
 	}
+	bool ok = gc_copy_out(fd, file_map, all_extents);
 	close(fd);
 	unlink(temp);
+	if (!ok)
+	    return;
     }
 
+    /* corrupt (or unreadable) objects are left in place, and stay
+     * marked busy so that GC won't pick them again
+     */
     lk.lock();
-    for (auto it = objs_to_clean.begin(); it != objs_to_clean.end(); it++) 
-	object_info.erase(object_info.find(it->first));
+    for (auto it = objs_to_clean.begin(); it != objs_to_clean.end(); it++) {
+	if (corrupt.find(it->first) != corrupt.end())
+	    continue;
+	if (object_info.pinned(it->first)) { // snap_create since we started
+	    object_info.set_busy(it->first, false);
+	    continue;
+	}
+	object_info.erase(it->first); // also clears busy
+	deferred_deletes.push_back((deferred_delete){
+		.seq = (uint32_t)it->first, .time = (uint32_t)seq.load()});
+    }
 
-    /* write checkpoint *before* deleting any objects
+    /* the checkpoint records the deferred deletes; delete_thread
+     * removes the objects later.
      */
     if (stopped)
 	return;
     if (objs_to_clean.size()) {
+	seal_stream();
 	int ckpt_seq = seq++;
 	do_log("gc ckpt %d\n", ckpt_seq);
 	write_checkpoint(ckpt_seq, lk);
-    
-	lk.unlock();
-	for (auto it = objs_to_clean.begin(); it != objs_to_clean.end(); it++) {
-	    objname name(prefix(), it->first);
-	    do_log("gc delete %s\n", name.c_str());
-	    objstore->delete_object(name.c_str());
-	    gc_deleted++;		// single-threaded, no lock needed
+    }
+}
+
+/* write live extents (in LBA order) from @all_extents out to new
+ * objects of up to 8MB each. Data comes from a temporary file
+ * @fd, where @file_map gives the location of each object range;
+ * extents which have been overwritten in the meantime are skipped.
+ * Used by GC and by the defragmenter. Returns false if stopped.
+ */
+bool translate_impl::gc_copy_out(int fd, extmap::cachemap &file_map,
+				 std::vector<gc_extent> &all_extents) {
+    while (all_extents.size() > 0) {
+	sector_t sectors = 0, max = 16 * 1024; // 8MB
+
+	auto it = all_extents.begin();
+	while (it != all_extents.end() && sectors < max) {
+	    auto [base, limit, ptr] = *it++;
+	    sectors += (limit - base);
+	    (void)ptr;	// suppress warning
+	}
+	std::vector<gc_extent> extents(std::make_move_iterator(all_extents.begin()),
+				     std::make_move_iterator(it));
+	all_extents.erase(all_extents.begin(), it);
+	
+	/* lock the map while we find out which pieces are still
+	 * valid and point the map at the new object; the data is
+	 * copied from the file after we drop the locks, so other
+	 * GC workers aren't held up.
+	 */
+	char *buf = (char*)aligned_alloc(512, sectors * 512);
+
+	std::unique_lock lk2(m);
+	seal_stream();
+	std::unique_lock objlock2(*map_lock);
+
+	off_t byte_offset = 0;
+	sector_t data_sectors = 0;
+	std::vector<data_map> obj_extents;
+	std::vector<std::pair<sector_t,sector_t>> pieces; // file sector, len
+
+	/* the extents may have been fragmented in the meantime...
+	 */
+	for (auto [base, limit, ptr] : extents) {
+	    for (auto it2 = map->lookup(base);
+		 it2 != map->end() && it2->base() < limit; it2++) {
+		 /* [_base,_limit] is a piece of the extent
+		  * obj_base is where that piece starts in the object
+		  */
+		auto [_base, _limit, obj_base] = it2->vals(base, limit);
+
+		/* skip if it's not still in the object, otherwise
+		 * _obj_limit is where it ends.
+		 */
+		if (obj_base.obj != ptr.obj)
+		    continue;
+		sector_t _sectors = _limit - _base;
+		auto obj_limit =
+		    extmap::obj_offset{obj_base.obj,
+				       obj_base.offset+_sectors};
+
+		/* file_sector is where that piece starts in 
+		 * the GC file... unless it moved to a part of the
+		 * object we didn't copy.
+		 */
+		auto it3 = file_map.lookup(obj_base);
+		if (it3 == file_map.end() || it3->base() > obj_base)
+		    continue;
+		auto [file_base,file_limit,file_sector] =
+		    it3->vals(obj_base, obj_limit);
+		(void)file_limit; // suppress warning
+		(void)file_base;  // suppress warning
+
+		size_t bytes = _sectors*512;
+		pieces.push_back(std::make_pair(file_sector, _sectors));
+		obj_extents.push_back((data_map){(uint64_t)_base, (uint64_t)_sectors});
+
+		data_sectors += _sectors;
+		byte_offset += bytes;
+	    }
 	}
+	int32_t _seq = seq++;	    
+
+	gc_sectors_written += data_sectors;
+	size_t max_hdr = obj_hdr_len(obj_extents.size(), data_sectors*512L) +
+	    checkpoints.size() * sizeof(uint32_t);
+	char *hdr = (char*)malloc(round_up(max_hdr, 512));
+	int hdr_sectors = make_gc_hdr(hdr, _seq, data_sectors,
+				      obj_extents.data(), obj_extents.size());
+	auto offset = hdr_sectors;
+
+	int gc_sectors = byte_offset / 512;
+	obj_info oi = {.hdr = hdr_sectors, .data = gc_sectors,
+	       .live = gc_sectors, .type = LSVD_DATA};
+	object_info.insert(_seq, oi);
+
+	std::vector<extmap::lba2obj> deleted;
+	for (auto e : obj_extents) {
+	    extmap::obj_offset oo = {_seq, offset};
+	    map->update(e.lba, e.lba+e.len, oo, &deleted);
+	    offset += e.len;
+	}
+	for (auto d : deleted) {
+	    auto [base, limit, ptr] = d.vals();
+	    object_info.add_live(ptr.obj, -(limit - base));
+	    total_live_sectors -= (limit - base);
+	}
+	verify_live();
+	objlock2.unlock();
+	lk2.unlock();
+
+	/* the temp file is private to this worker, and readers of the
+	 * new object will block in wait_object_ready until it's written
+	 */
+	char *ptr = buf;
+	for (auto [file_sector, _sectors] : pieces) {
+	    size_t bytes = _sectors*512;
+	    auto err = pread(fd, ptr, bytes, file_sector*512);
+	    assert(err == (ssize_t)bytes);
+	    (void)err;
+	    ptr += bytes;
+	}
+
+	obj_set_crcs(hdr, buf, hdr_sectors*512L, byte_offset);
+	obj_seal_hdr(hdr);
+
+	smartiov iovs;
+	iovs.push_back((iovec){hdr, (size_t)hdr_sectors*512});
+	iovs.push_back((iovec){buf, (size_t)byte_offset});
+
+	auto t_req = new translate_req(_seq, this);
+	t_req->to_free.push_back(hdr);
+	t_req->to_free.push_back(buf);
+
+	if (stopped)
+	    return false;
+	
+	objname name(prefix(_seq), _seq);
+	auto [iov,iovcnt] = iovs.c_iov();
+	auto req = objstore->make_write_req(name.c_str(), iov, iovcnt);
+	req->run(t_req);
+	do_log("gc write %s\n", name.c_str());
+    }
+    return true;
+}
+
+/* delete objects cleaned by GC once (a) a checkpoint written after
+ * they were cleaned is in the superblock, and (b) the write frontier
+ * has moved cfg->gc_delete_grace objects past them, so that any
+ * reads which looked up the old location have finished.
+ */
+void translate_impl::delete_thread(thread_pool<int> *p) {
+    auto interval = std::chrono::milliseconds(1000);
+    pthread_setname_np(pthread_self(), "delete_thread");
+
+    while (p->running) {
+	std::unique_lock lk(m);
+	p->cv.wait_for(lk, interval);
+	if (!p->running)
+	    return;
+
+	std::vector<uint32_t> batch;
+	for (auto const &d : deferred_deletes)
+	    if ((int)d.time <= ckpt_durable &&
+		seq - (int)d.time >= cfg->gc_delete_grace &&
+		object_info.find(d.seq) == NULL)
+		batch.push_back(d.seq);
+	if (batch.size() == 0)
+	    continue;
+	lk.unlock();
+
+	/* the backend only has single-object deletes, so issue
+	 * them from a few threads at once
+	 */
+	int n = std::min((int)batch.size(), 4);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < n; i++)
+	    workers.push_back(std::thread([&, i] {
+			for (size_t j = i; j < batch.size(); j += n) {
+			    objname name(prefix(batch[j]), batch[j]);
+			    do_log("gc delete %s\n", name.c_str());
+			    objstore->delete_object(name.c_str());
+			}
+		    }));
+	for (auto &t : workers)
+	    t.join();
+	gc_deleted += batch.size();
+
 	lk.lock();
+	std::set<uint32_t> deleted(batch.begin(), batch.end());
+	deferred_deletes.erase(
+	    std::remove_if(deferred_deletes.begin(), deferred_deletes.end(),
+			   [&](deferred_delete &d){return deleted.count(d.seq) > 0;}),
+	    deferred_deletes.end());
     }
 }
 
 void translate_impl::wait_for_gc(void) {
     std::unique_lock lk(m);
-    while (gc_running)
+    while (gc_running > 0)
 	gc_cv.wait(lk);
 }
 
+/* cfg->gc_threads of these run concurrently, each cleaning its own
+ * (disjoint) set of victims. Only one of them compacts at a time.
+ */
 void translate_impl::gc_thread(thread_pool<int> *p) {
     auto interval = std::chrono::milliseconds(100);
+    auto compact_interval = std::chrono::milliseconds(cfg->compact_msec);
     sector_t trigger = 128 * 1024 * 2; // 128 MB
     const char *name = "gc_thread";
     pthread_setname_np(pthread_self(), name);
@@ -1066,24 +3034,349 @@ void translate_impl::gc_thread(thread_pool<int> *p) {
 	p->cv.wait_for(lk, interval);
 	if (!p->running)
 	    return;
+	if (!map_loaded || gc_paused) // lazy open, snap_rollback
+	    continue;
 
-	/* check to see if we should run a GC cycle
+	/* check to see if we should run a GC cycle, or failing
+	 * that a (rate-limited) compaction cycle
 	 */
-	if (total_sectors - total_live_sectors < trigger)
-	    continue;
-	if (((double)total_live_sectors / total_sectors) > 0.6)
+	bool need_gc = (total_sectors - total_live_sectors >= trigger &&
+			((double)total_live_sectors / total_sectors) <= 0.6);
+	auto now = std::chrono::system_clock::now();
+	bool need_compact = (cfg->compact_min_objs > 0 &&
+			     now - last_compact > compact_interval);
+	if (!need_gc && !need_compact)
 	    continue;
 
-	gc_running = true;
-	do_gc(lk, &p->running);
-	gc_running = false;
+	gc_running++;
+	if (need_gc)
+	    do_gc(lk, &p->running);
+	else {
+	    last_compact = now;
+	    do_compact(lk, &p->running);
+	}
+	if (!lk.owns_lock())
+	    lk.lock();
+	gc_running--;
 	gc_cv.notify_all();
     }
 }
     
+/* -------------- Offline repack ---------------- */
+
+/* GC only cleans objects below 50% utilization, a few at a time,
+ * and leaves the map as fragmented as it found it. With the volume
+ * closed we can instead copy everything, in LBA order, into new
+ * full-size objects through the normal write path, then drop all
+ * the old objects at once. Objects pinned by snapshots, clone bases
+ * or dedup stay where they are. Not safe with concurrent writes,
+ * which the copy could overwrite with older data.
+ */
+int translate_impl::repack(int nthreads) {
+    load_map(0, super_sh->vol_size * 512L);
+    flush();
+
+    std::unique_lock lk(m);
+    std::vector<std::pair<int,int>> objs;
+    object_info.get_victims(1.0, seq.load(), objs);
+    objs.erase(
+	std::remove_if(objs.begin(), objs.end(),
+		       [&](auto v) {return dedup_pins.count(v.first) > 0;}),
+	objs.end());
+    if (objs.size() == 0)
+	return 0;
+    std::vector<bool> bitmap(seq.load()+1);
+    for (auto const &v : objs) {
+	bitmap[v.first] = true;
+	object_info.set_busy(v.first, true); // no dedup hits on them
+    }
+
+    /* live extents, in LBA order, in pieces of at most 4MB
+     */
+    const int64_t max_sectors = 8192, window = 8 * max_sectors;
+    std::vector<gc_extent> extents;
+    std::shared_lock slk(*map_lock);
+    for (auto it = map->begin(); it != map->end(); it++) {
+	auto [base, limit, ptr] = it->vals();
+	if (!bitmap[ptr.obj])
+	    continue;
+	for (int64_t i = base; i < limit; i += max_sectors) {
+	    extmap::obj_offset oo = {ptr.obj, ptr.offset + (i - base)};
+	    extents.push_back((gc_extent){i, std::min(i + max_sectors, limit),
+					  oo});
+	}
+    }
+    slk.unlock();
+    lk.unlock();
+
+    /* read up to @window sectors with @nthreads parallel ranged
+     * reads, then write them back in LBA-contiguous runs, in pieces
+     * no bigger than a write from the write cache, which always fit
+     * in a batch
+     */
+    size_t max_write = std::min(cfg->batch_size, cfg->wcache_chunk);
+    char *buf = (char*)aligned_alloc(512, window * 512);
+    std::vector<char> bad(extents.size()); // failed CRC check
+    std::set<int> corrupt;
+    for (size_t i = 0; i < extents.size(); ) {
+	std::vector<int64_t> offsets;
+	size_t j = i;
+	for (int64_t sectors = 0; j < extents.size(); j++) {
+	    int64_t len = extents[j].limit - extents[j].base;
+	    if (sectors + len > window)
+		break;
+	    offsets.push_back(sectors);
+	    sectors += len;
+	}
+
+	std::atomic<size_t> next(i);
+	std::vector<std::thread> readers;
+	for (int k = 0; k < std::max(nthreads, 1); k++)
+	    readers.push_back(std::thread([&] {
+			for (size_t n = next++; n < j; n = next++) {
+			    auto &e = extents[n];
+			    bad[n] = read_checked(e.ptr.obj, e.ptr.offset*512L,
+						  buf + offsets[n-i]*512,
+						  (e.limit - e.base)*512L) < 0;
+			}
+		    }));
+	for (auto &t : readers)
+	    t.join();
+
+	/* corrupt (or unreadable) pieces aren't copied, so the objects
+	 * they're in stay live and are left in place
+	 */
+	for (size_t k = i; k < j; ) {
+	    if (bad[k]) {
+		corrupt.insert(extents[k++].ptr.obj);
+		continue;
+	    }
+	    size_t n = k + 1;
+	    while (n < j && !bad[n] && extents[n].base == extents[n-1].limit)
+		n++;
+	    size_t bytes = (offsets[n-1-i] - offsets[k-i] +
+			    extents[n-1].limit - extents[n-1].base) * 512;
+	    for (size_t done = 0; done < bytes; done += max_write) {
+		iovec iov = {buf + offsets[k-i]*512 + done,
+			     std::min(max_write, bytes - done)};
+		wait_for_room();
+		writev(max_cache_seq, extents[k].base*512L + done, &iov, 1);
+	    }
+	    k = n;
+	}
+	i = j;
+    }
+    free(buf);
+    flush();
+
+    if (corrupt.size() > 0)
+	do_log("repack: %d objects failed CRC check, left in place\n",
+	       (int)corrupt.size());
+
+    /* the old objects are all dead now, unless a read failed.
+     * With no readers, GC's deferred deletes can go too; checkpoint
+     * before deleting anything.
+     */
+    lk.lock();
+    std::vector<int> dead;
+    for (auto const &v : objs) {
+	object_info.set_busy(v.first, false);
+	if (object_info.find(v.first)->live > 0)
+	    continue;
+	object_info.erase(v.first);
+	dead.push_back(v.first);
+    }
+    for (auto const &d : deferred_deletes)
+	if (object_info.find(d.seq) == NULL)
+	    dead.push_back(d.seq);
+    deferred_deletes.erase(
+	std::remove_if(deferred_deletes.begin(), deferred_deletes.end(),
+		       [&](deferred_delete &d){
+			   return object_info.find(d.seq) == NULL;}),
+	deferred_deletes.end());
+    int ckpt_seq = seq++;
+    if (!write_checkpoint(ckpt_seq, lk)) {
+	/* the superblock still points at the old map; leave them
+	 * for the delete thread, after a checkpoint that gets in
+	 */
+	for (auto d : dead)
+	    deferred_deletes.push_back((deferred_delete){
+		    .seq = (uint32_t)d, .time = (uint32_t)seq.load()});
+	return -EIO;
+    }
+    lk.unlock();
+
+    int n = std::min((int)dead.size(), 4);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < n; i++)
+	workers.push_back(std::thread([&, i] {
+		    for (size_t j = i; j < dead.size(); j += n) {
+			objname name(prefix(dead[j]), dead[j]);
+			objstore->delete_object(name.c_str());
+		    }
+		}));
+    for (auto &t : workers)
+	t.join();
+    gc_deleted += dead.size();
+
+    if (corrupt.size() > 0)
+	return -EIO;
+    return dead.size();
+}
+
+/* -------------- Defragmentation ---------------- */
+
+/* called from the read path (read cache) for each piece of a read
+ * which goes to the backend, so fragmented regions accumulate heat
+ * faster than contiguous ones.
+ */
+void translate_impl::note_read(size_t offset, size_t len) {
+    int64_t base = offset / 512, limit = base + len / 512;
+    for (int64_t r = base / defrag_sectors;
+	 r < n_regions && r * defrag_sectors < limit; r++)
+	heat[r]++;
+}
+
+/* find hot regions which map to many discontiguous pieces of objects,
+ * and rewrite them contiguously using the GC output path. Uses up
+ * to @budget sectors, subtracting what it uses.
+ */
+void translate_impl::do_defrag(std::unique_lock<std::mutex> &lk,
+			       int64_t &budget) {
+    /* hottest regions first. Halve the heat each pass, so it
+     * reflects recent reads
+     */
+    std::vector<std::pair<uint32_t,int64_t>> hot;
+    for (int64_t i = 0; i < n_regions; i++) {
+	uint32_t h = heat[i].load();
+	if (h == 0)
+	    continue;
+	heat[i] = h / 2;
+	hot.push_back(std::make_pair(h, i));
+    }
+    std::sort(hot.begin(), hot.end(), std::greater<>());
+
+    std::vector<gc_extent> extents;
+    std::unique_lock objlock(*map_lock);
+    for (auto [h, r] : hot) {
+	int64_t base = r * defrag_sectors, limit = base + defrag_sectors;
+	std::vector<gc_extent> pieces;
+	int fragments = 0;
+	bool ready = true;
+	sector_t sectors = 0;
+	extmap::obj_offset next = {-1, 0};
+
+	for (auto it = map->lookup(base);
+	     it != map->end() && it->base() < limit; it++) {
+	    auto [_base, _limit, ptr] = it->vals(base, limit);
+	    if (!completions.ready(ptr.obj) || object_info.busy(ptr.obj) ||
+		dedup_pins.count(ptr.obj) > 0)
+		ready = false;
+	    if (ptr.obj != next.obj || ptr.offset != next.offset)
+		fragments++;
+	    next = {ptr.obj, ptr.offset + (_limit - _base)};
+	    sectors += (_limit - _base);
+	    pieces.push_back((gc_extent){_base, _limit, ptr});
+	}
+	if (!ready || fragments < cfg->defrag_extents)
+	    continue;
+	if (sectors > budget)
+	    break;
+	budget -= sectors;
+	extents.insert(extents.end(), pieces.begin(), pieces.end());
+    }
+    objlock.unlock();
+    if (extents.size() == 0)
+	return;
+
+    /* like GC, mark the sources busy so that dedup hits can't remap
+     * an LBA to some other part of them while we're copying
+     */
+    std::set<int> objs;
+    for (auto const &e : extents)
+	if (object_info.find(e.ptr.obj) != NULL)
+	    objs.insert(e.ptr.obj);
+    for (auto o : objs)
+	object_info.set_busy(o, true);
+
+    defrag_cycles++;
+    lk.unlock();
+
+    /* copy the pieces into a temporary file, then write them out in
+     * LBA order
+     */
+    char temp[cfg->cache_dir.size() + 20];
+    sprintf(temp, "%s/defrag.XXXXXX", cfg->cache_dir.c_str());
+    int fd = mkstemp(temp);
+
+    extmap::cachemap file_map;
+    sector_t offset = 0;
+    char *buf = (char*)malloc(defrag_sectors * 512);
+
+    std::sort(extents.begin(), extents.end(),
+	      [](gc_extent &a, gc_extent &b){return a.base < b.base;});
+    std::vector<gc_extent> copied;
+    for (auto [base, limit, ptr] : extents) {
+	sector_t sectors = limit - base;
+	if (read_checked(ptr.obj, ptr.offset*512L, buf, sectors*512L) < 0)
+	    continue;		// corrupt: leave it where it is
+	extmap::obj_offset _limit = {ptr.obj, ptr.offset + sectors};
+	file_map.update(ptr, _limit, offset);
+	if (write(fd, buf, sectors*512) < 0)
+	    throw("no space");
+	offset += sectors;
+	copied.push_back((gc_extent){base, limit, ptr});
+    }
+    free(buf);
+    do_log("defrag: %d extents, %d sectors\n", (int)copied.size(),
+	   (int)offset);
+
+    gc_copy_out(fd, file_map, copied);
+    close(fd);
+    unlink(temp);
+    lk.lock();
+    for (auto o : objs)
+	if (object_info.find(o) != NULL)
+	    object_info.set_busy(o, false);
+}
+
+/* wake up once a second, and defragment using up to cfg->defrag_mbps
+ * worth of backend bandwidth (with bursts up to 4 seconds' worth)
+ */
+void translate_impl::defrag_thread(thread_pool<int> *p) {
+    auto interval = std::chrono::milliseconds(1000);
+    int64_t rate = (int64_t)cfg->defrag_mbps * 1024 * 1024 / 512; // sectors/s
+    int64_t budget = 0;
+    auto t0 = std::chrono::system_clock::now();
+    pthread_setname_np(pthread_self(), "defrag_thread");
+
+    while (p->running) {
+	std::unique_lock lk(m);
+	p->cv.wait_for(lk, interval);
+	if (!p->running)
+	    return;
+	if (!map_loaded || gc_paused)
+	    continue;
+
+	auto t1 = std::chrono::system_clock::now();
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1-t0);
+	t0 = t1;
+	budget = std::min(budget + rate * ms.count() / 1000, 4 * rate);
+
+	gc_running++;
+	do_defrag(lk, budget);
+	if (!lk.owns_lock())
+	    lk.lock();
+	gc_running--;
+	gc_cv.notify_all();
+    }
+}
+
 /* ---------------- Debug ---------------- */
 
-/* synchronous read from offset (in bytes)
+/* synchronous read from offset (in bytes). Backend reads are always
+ * CRC-checked; returns -EIO if any of them failed, after reading
+ * the rest.
  */
 ssize_t translate_impl::readv(size_t offset, iovec *iov, int iovcnt) {
     smartiov iovs(iov, iovcnt);
@@ -1091,24 +3384,54 @@ ssize_t translate_impl::readv(size_t offset, iovec *iov, int iovcnt) {
     int64_t base = offset / 512;
     int64_t sectors = len / 512, limit = base + sectors;
 
-    /* various things break when map size is zero
-     */
-    if (map->size() == 0) {
-	iovs.zero();
-	return len;
-    }
-
     /* object number, offset (bytes), length (bytes) */
     std::vector<std::tuple<int, size_t, size_t>> regions;
 	
-    auto prev = base;
-    {
-	std::unique_lock lk(m);
-	std::shared_lock slk(*map_lock);
+    load_map(offset, len);
 
+    /* dedup hits in the open batch aren't in the map or the bufmap
+     * yet, so they go on top of the map here
+     */
+    auto prev = base;
+    extmap::objmap view;
+    std::unique_lock lk(m);
+    std::shared_lock slk(*map_lock);
+    if (map->size() > 0)	// various things break when it's zero
 	for (auto it = map->lookup(base);
 	     it != map->end() && it->base() < limit; it++) {
 	    auto [_base, _limit, oo] = it->vals(base, limit);
+	    view.update(_base, _limit, oo);
+	}
+    if (b->dups.size() > 0)
+	for (auto it = b->dups.lookup(base);
+	     it != b->dups.end() && it->base() < limit; it++) {
+	    auto [_base, _limit, oo] = it->vals(base, limit);
+	    view.update(_base, _limit, oo);
+	}
+
+    /* the open batch isn't in the map yet, and anything in memory is
+     * at least as new as what the map points to. Copy it now - once
+     * it's written the bufmap entries go away, but our view of the
+     * map is still the old one.
+     */
+    std::vector<std::pair<int64_t,int64_t>> buffered;
+    char *mem = NULL;
+    std::unique_lock lk2(bufmap_m);
+    for (auto it = bufmap.lookup(base);
+	 it != bufmap.end() && it->base() < limit; it++) {
+	auto [_base, _limit, ptr] = it->vals(base, limit);
+	if (mem == NULL)
+	    mem = (char*)malloc(len);
+	memcpy(mem + (_base - base)*512, ptr.buf, (_limit - _base)*512);
+	buffered.push_back(std::pair(_base, _limit));
+    }
+    lk2.unlock();
+    slk.unlock();
+    lk.unlock();
+
+    if (view.size() > 0) {
+	for (auto it = view.begin(); it != view.end(); it++) {
+	    auto [_base, _limit, oo] = it->vals();
 	    if (_base > prev) {	// unmapped
 		size_t _len = (_base - prev)*512;
 		regions.push_back(std::tuple(-1, 0, _len));
@@ -1119,29 +3442,50 @@ ssize_t translate_impl::readv(size_t offset, iovec *iov, int iovcnt) {
 	}
     }
 
-    if (regions.size() == 0) {
-	iovs.zero();
-	return 0;
-    }
-    
     size_t iov_offset = 0;
+    int rv = 0;
     for (auto [obj, _offset, _len] : regions) {
 	auto slice = iovs.slice(iov_offset, iov_offset + _len);
 	if (obj == -1)
 	    slice.zero();
-	else {
-	    objname name(prefix(), obj);
-	    auto [iov,iovcnt] = slice.c_iov();
-	    objstore->read_object(name.c_str(), iov, iovcnt, _offset);
+	else if (check_object_ready(obj) ||
+		 !read_buffered(offset + iov_offset, &slice)) {
+	    wait_object_ready(obj);	// e.g. journal refs, GC
+	    char *tmp = (char*)malloc(_len);
+	    if (read_checked(obj, _offset, tmp, _len) < 0) {
+		memset(tmp, 0, _len);
+		rv = -EIO;
+	    }
+	    slice.copy_in(tmp);
+	    free(tmp);
 	}
 	iov_offset += _len;
     }
 
     if (iov_offset < iovs.bytes()) {
-	auto slice = iovs.slice(iov_offset, len - iov_offset);
+	auto slice = iovs.slice(iov_offset, len);
 	slice.zero();
     }
-    
+
+    for (auto [_base, _limit] : buffered) {
+	auto slice = iovs.slice((_base - base)*512, (_limit - base)*512);
+	slice.copy_in(mem + (_base - base)*512);
+    }
+    free(mem);
+    return rv;
+}
+
+/* volume UUID from the superblock, for finding the cache file
+ */
+int translate_get_uuid(backend *objstore, const char *name, uuid_t &uu) {
+    object_reader parser(objstore);
+    std::vector<uint32_t>    ckpts;
+    std::vector<clone_info*> clones;
+    std::vector<snap_info*>  snaps;
+    auto [buf, bytes] = parser.read_super(name, ckpts, clones, snaps, uu);
+    if (buf == NULL)
+	return -1;
+    free(buf);
     return 0;
 }
 
@@ -1176,6 +3520,124 @@ int translate_create_image(backend *objstore, const char *name,
     return rv;
 }
 
+/* a clone starts out as just a superblock: the parent's clone list
+ * plus the parent itself, bounded by snapshot @snap, whose checkpoint
+ * is the clone's first. New objects are numbered from there on, so
+ * object numbers for base data are the same in the parent and every
+ * clone. The snapshot keeps the parent from freeing any of it, and
+ * the clone goes in its clone list so that it can't be removed.
+ * Base data isn't cached in common, though - each image has its own
+ * read cache (see read_cache.cc).
+ */
+int translate_clone_image(backend *objstore, const char *parent,
+			  const char *snap, const char *name) {
+    object_reader parser(objstore);
+    std::vector<uint32_t>    ckpts;
+    std::vector<clone_info*> clones;
+    std::vector<snap_info*>  snaps;
+    uuid_t uu;
+    auto [pbuf, bytes] = parser.read_super(parent, ckpts, clones, snaps, uu);
+    if (pbuf == NULL)
+	return -1;
+
+    int seq = -1;
+    for (auto si : snaps)
+	if (std::string(si->name, si->name_len) == snap)
+	    seq = si->seq;
+
+    auto buf = (char*)aligned_alloc(512, 4096);
+    memset(buf, 0, 4096);
+    auto _hdr = (obj_hdr*) buf;
+    *_hdr = (obj_hdr){LSVD_MAGIC, 1, {0}, LSVD_SUPER, 0, 8, 0};
+    uuid_generate_random(_hdr->vol_uuid);
+
+    auto _super = (super_hdr*)(_hdr + 1);
+    auto psuper = (super_hdr*)(pbuf + sizeof(obj_hdr));
+    *_super = (super_hdr){psuper->vol_size, 0, 0, (uint32_t)seq + 1,
+			  0, 0, 0, 0, 0, 0};
+
+    size_t offset = sizeof(obj_hdr) + sizeof(super_hdr);
+    _super->ckpts_offset = offset;
+    _super->ckpts_len = sizeof(uint32_t);
+    *(uint32_t*)(buf + offset) = seq;
+    offset += sizeof(uint32_t);
+
+    /* leave room for 4 checkpoints, like snap_create
+     */
+    _super->clones_offset = offset;
+    size_t len = strlen(parent) + sizeof(clone_info) + 3*sizeof(uint32_t);
+    for (auto ci : clones)
+	len += sizeof(clone_info) + ci->name_len;
+    int rv = -ENOSPC;
+    if (seq < 0)
+	rv = -ENOENT;
+    else if (strlen(parent) > 255)
+	rv = -EINVAL;
+    else if (offset + len <= 4096) {
+	for (auto ci : clones) {
+	    size_t n = sizeof(clone_info) + ci->name_len;
+	    memcpy(buf + offset, ci, n);
+	    offset += n;
+	}
+	auto ci = (clone_info*)(buf + offset);
+	memcpy(ci->vol_uuid, uu, sizeof(uuid_t));
+	ci->sequence = seq;
+	ci->name_len = strlen(parent);
+	memcpy(ci->name, parent, ci->name_len);
+	offset += sizeof(clone_info) + ci->name_len;
+	_super->clones_len = offset - _super->clones_offset;
+	_super->snaps_offset = offset;
+
+	iovec iov = {buf, 4096};
+	rv = objstore->write_object(name, &iov, 1) < 0 ? -EIO : 0;
+    }
+    free(pbuf);
+    free(buf);
+
+    std::vector<std::string> names;
+    if (rv == 0) {
+	read_clone_list(objstore, parent, seq, names);
+	names.push_back(name);
+	if (write_clone_list(objstore, parent, seq, names) < 0) {
+	    objstore->delete_object(name);
+	    rv = -EIO;
+	}
+    }
+    return rv;
+}
+
+/* remove an image, unless it has clones. A clone is taken out of its
+ * parent's clone list first.
+ */
+int translate_remove_image(backend *objstore, const char *name) {
+    object_reader parser(objstore);
+    std::vector<uint32_t>    ckpts;
+    std::vector<clone_info*> clones;
+    std::vector<snap_info*>  snaps;
+    uuid_t uu;
+    auto [buf, bytes] = parser.read_super(name, ckpts, clones, snaps, uu);
+    if (buf != NULL) {
+	std::vector<std::string> names;
+	for (auto si : snaps) {
+	    read_clone_list(objstore, name, si->seq, names);
+	    if (names.size() > 0) {
+		free(buf);
+		return -EBUSY;
+	    }
+	}
+	if (clones.size() > 0) {
+	    auto ci = clones.back();
+	    std::string parent(ci->name, ci->name_len);
+	    read_clone_list(objstore, parent.c_str(), ci->sequence, names);
+	    names.erase(std::remove(names.begin(), names.end(), name),
+			names.end());
+	    write_clone_list(objstore, parent.c_str(), ci->sequence, names);
+	}
+	free(buf);
+    }
+    return objstore->delete_prefix(name);
+}
+
 void translate_impl::getmap(int base, int limit,
 		       int (*cb)(void *ptr,int,int,int,int), void *ptr) {
     for (auto it = map->lookup(base); it != map->end() && it->base() < limit; it++) {
@@ -1187,8 +3649,8 @@ void translate_impl::getmap(int base, int limit,
 
 void translate_impl::set_completion(int next)
 {
-    if (next > next_compln)
-	next_compln= next;
+    if (next > completions.next())
+	completions.set_next(next);
 }
 
 int batch_seq(translate *xlate_) {
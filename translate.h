@@ -12,9 +12,27 @@
 #define TRANSLATE_H
 
 struct iovec;
+class smartiov;
+class nvme;
 class backend;
 class lsvd_config;
 
+/* data object write statistics, from translate::get_stats
+ */
+struct xlate_stats {
+    double   objs_per_sec;	// over the last 32 objects
+    uint64_t batch_size;	// current batch size (bytes)
+    uint64_t objs_written;
+    uint64_t bytes_written;
+    uint64_t size_hist[16];	// [i]: objects < 64KB<<i, [15]: the rest
+    uint64_t crc_checks;	// data CRC checks, reads and GC
+    uint64_t crc_errors;	// bad chunks found
+    uint64_t dedup_lookups;	// 4KB blocks written, if dedup is on
+    uint64_t dedup_hits;	// ...that were already on the backend
+    uint64_t dedup_entries;	// current index size
+    uint64_t trimmed_sectors;	// discarded
+};
+
 class translate {
 public:
     uuid_t    uuid;
@@ -26,8 +44,9 @@ public:
     virtual ssize_t init(const char *name, int nthreads, bool timedflush) = 0;
     virtual void shutdown(void) = 0;
 
-    virtual int flush(void) = 0;      /* write out current batch */
-    virtual int checkpoint(void) = 0; /* flush, then write checkpoint */
+    virtual int flush(void) = 0;      /* write out batch, return last seq */
+    virtual int checkpoint(void) = 0; /* flush, then write checkpoint;
+					 * returns its seq, or -EIO */
 
     virtual ssize_t writev(uint64_t cache_seq, size_t offset,
                            iovec *iov, int iovcnt) = 0;
@@ -35,8 +54,67 @@ public:
     virtual ssize_t readv(size_t offset, iovec *iov, int iovcnt) = 0;
     virtual bool check_object_ready(int obj) = 0; /* GC stalls */
     virtual void wait_object_ready(int obj) = 0;
-    
-    virtual const char *prefix() = 0; /* for read cache */
+    virtual void note_read(size_t offset, size_t len) = 0; /* for defrag */
+    virtual bool read_buffered(size_t offset, smartiov *iov) = 0;
+    virtual bool verify_read(int obj, size_t offset, /* data CRCs */
+                             const char *buf, size_t len,
+                             bool always = false) = 0;
+    virtual void load_map(size_t offset, size_t len) = 0; /* lazy open */
+
+    /* journal-reference batches (cfg->xlate_refs): the data is at
+     * @j_offset on the write cache SSD, and is read back at upload
+     * time. Journal records with sequence >= oldest_ref() are still
+     * needed.
+     */
+    virtual ssize_t writev_ref(uint64_t cache_seq, size_t offset,
+                               size_t len, size_t j_offset) = 0;
+    virtual void set_journal(nvme *j) = 0;
+    virtual uint64_t oldest_ref(void) = 0;
+
+    /* discard: unmap [offset, offset+len) (bytes)
+     */
+    virtual ssize_t trim(uint64_t cache_seq, size_t offset, size_t len) = 0;
+
+    /* snapshots: a checkpoint kept in the superblock snapshot list,
+     * whose objects GC leaves alone. rollback replaces the map with
+     * the snapshot's and writes it as a new checkpoint, so it takes
+     * effect in one superblock write, or not at all (-EIO); the
+     * caller flushes the caches and invalidates the write cache
+     * first (see rbd_snap_rollback). create writes a full checkpoint,
+     * so it's O(map) - there's no O(1) create. remove fails (-EBUSY)
+     * if the snapshot has clones.
+     */
+    virtual int snap_create(const char *name) = 0;
+    virtual int snap_remove(const char *name) = 0;
+    virtual int snap_rollback(const char *name) = 0;
+    virtual void snap_list(std::vector<std::pair<int,std::string>> &snaps) = 0;
+
+    /* map queries for backup: @cb(offset, len, exists, arg) for each
+     * allocated extent in [@offset, @offset+@len) (bytes) in objects
+     * newer than @since, or each extent which differs from snapshot
+     * @snap, including ones discarded since then (exists=0). Stops
+     * early if @cb returns < 0. Data in the open batch isn't mapped
+     * until flush()
+     */
+    virtual int map_iterate(int since, uint64_t offset, uint64_t len,
+                            int (*cb)(uint64_t, size_t, int, void*),
+                            void *arg) = 0;
+    virtual int diff_iterate(const char *snap, uint64_t offset, uint64_t len,
+                             int (*cb)(uint64_t, size_t, int, void*),
+                             void *arg) = 0;
+
+    /* offline only: rewrite live data into new objects in LBA order
+     * and delete the old ones. Returns objects deleted or -errno
+     */
+    virtual int repack(int nthreads) = 0;
+
+    virtual const char *prefix(int seq) = 0; /* object names, read cache */
+
+    /* map snapshot in the cache file: set the region before init(),
+     * write it at clean close after checkpoint()
+     */
+    virtual void set_map_snapshot(int fd, int base, int blocks) = 0;
+    virtual int write_map_snapshot(void) = 0;
 
     virtual void wait_for_gc(void) = 0; /* do this before shutdown */
     virtual void start_gc(void) = 0;
@@ -48,6 +126,7 @@ public:
     virtual int mapsize(void) = 0;
     virtual void reset(void) = 0;
     virtual int frontier(void) = 0;
+    virtual void get_stats(xlate_stats *s) = 0;
     virtual void set_completion(int next) = 0;
 };
 
@@ -57,4 +136,12 @@ extern translate *make_translate(backend *_io, lsvd_config *cfg,
 extern int translate_create_image(backend *objstore, const char *name,
                                   uint64_t size);
 
+extern int translate_clone_image(backend *objstore, const char *parent,
+                                 const char *snap, const char *name);
+
+extern int translate_remove_image(backend *objstore, const char *name);
+
+extern int translate_get_uuid(backend *objstore, const char *name,
+                              uuid_t &uu);
+
 #endif
@@ -414,6 +414,170 @@ void test_9_delete(void)
 }
 
 
+// test 10 - object table: lookup, erase, victims follow live counts
+//
+#include "obj_table.h"
+
+void test_10_obj_table(void)
+{
+    obj_table t;
+    int max = 1000;
+
+    for (int i = 1; i <= max; i++) {
+	auto type = (i % 100 == 0) ? LSVD_CKPT : LSVD_DATA;
+	t.insert(i, (obj_info){.hdr = 8, .data = 100, .live = 100,
+		    .type = type});
+    }
+    assert(t.size() == max && t.first() == 1 && t.limit() == max+1);
+
+    std::vector<std::pair<int,int>> v;
+    t.get_victims(0.5, 100, v);
+    assert(v.size() == 0);
+
+    for (int i = 1; i <= max; i++)
+	if (i % 7 == 0 && i % 100 != 0)
+	    t.add_live(i, -(i % 90));
+    for (int i = 1; i <= max; i++)
+	if (i % 7 == 0 && i % 100 != 0)
+	    assert(t.find(i)->live == 100 - (i % 90));
+
+    t.get_victims(0.5, max, v);
+    for (auto [s, n] : v) {
+	assert(s % 7 == 0 && t.find(s)->live <= 50 && n == 108);
+	t.erase(s);
+	assert(t.find(s) == NULL);
+    }
+    v.clear();
+    t.get_victims(0.5, max, v);
+    assert(v.size() == 0);
+
+    /* pinned objects are skipped until the last reference goes
+     */
+    t.add_live(501, -100);
+    t.snap_ref(501, 1);
+    t.snap_ref(501, 1);
+    t.get_victims(0.5, max, v);
+    assert(v.size() == 0 && t.pinned(501));
+    t.snap_ref(501, -1);
+    t.get_victims(0.5, max, v);
+    assert(v.size() == 0);
+    t.snap_ref(501, -1);
+    t.get_victims(0.5, max, v);
+    assert(v.size() == 1 && v[0].first == 501 && !t.pinned(501));
+    t.insert(501, (obj_info){.hdr = 8, .data = 100, .live = 100,
+		.type = LSVD_DATA});
+
+    for (int i = 1; i <= 500; i++)
+	if (t.find(i))
+	    t.erase(i);
+    assert(t.first() > 500 && t.find(500) == NULL && t.find(501) != NULL);
+    
+    printf("%s: OK\n", __func__);
+}
+
+
+// test 11 - completion tracker: out-of-order completions, far more
+// than 128 in flight, waiters woken when their object completes
+//
+#include <thread>
+#include <algorithm>
+#include "compln_tracker.h"
+
+void test_11_compln(void)
+{
+    compln_tracker c;
+    int max = 5000;
+    c.set_next(100);
+
+    std::vector<int> seqs;
+    for (int i = 100; i < 100+max; i++)
+	seqs.push_back(i);
+    std::mt19937 rng(17);
+    std::shuffle(seqs.begin(), seqs.end(), rng);
+
+    std::mutex m;
+    int woken = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+	threads.push_back(std::thread([&c, &m, &woken, i, max]() {
+		    std::unique_lock lk(m);
+		    int seq = 100 + (i+1) * max / 5;
+		    while (!c.ready(seq))
+			c.wait(seq, lk);
+		    assert(c.next() > seq);
+		    woken++;
+		}));
+
+    int lowest = 100;
+    for (auto s : seqs) {
+	c.complete(s);
+	if (s == lowest)
+	    while (lowest < 100+max && c.ready(lowest))
+		lowest++;
+	assert(c.next() == lowest);
+    }
+    for (auto &t : threads)
+	t.join();
+    assert(woken == 4 && c.next() == 100+max && c.pending() == 0);
+
+    c.complete(50);		// already done, ignored
+    assert(c.next() == 100+max);
+
+    printf("%s: OK\n", __func__);
+}
+
+#include "crc32c.h"
+
+void test_12_crc32c(void)
+{
+    const char *check = "123456789";
+    assert(crc32c_sw(0, check, 9) == 0xe3069283);
+    char zeros[32] = {0};
+    assert(crc32c_sw(0, zeros, 32) == 0x8a9136aa);
+    assert(crc32c(0, check, 9) == 0xe3069283);
+
+    /* hardware and table agree, for any alignment and length, and
+     * a buffer can be done in pieces
+     */
+    std::mt19937 rng(17);
+    std::vector<unsigned char> buf(70000);
+    for (auto &c : buf)
+	c = rng();
+    for (int i = 0; i < 1000; i++) {
+	size_t off = rng() % 64, len = rng() % (buf.size() - 64);
+	uint32_t c1 = crc32c_sw(0, buf.data() + off, len);
+	if (crc32c_hw_ok())
+	    assert(crc32c_hw(0, buf.data() + off, len) == c1);
+	size_t n = len ? rng() % len : 0;
+	uint32_t c2 = crc32c(0, buf.data() + off, n);
+	assert(crc32c(c2, buf.data() + off + n, len - n) == c1);
+    }
+
+    printf("%s: OK (%s)\n", __func__, crc32c_hw_ok() ? "hw" : "table");
+}
+
+// test 13 - trimming an empty map leaves it empty
+//
+void test_13_trim_empty(void)
+{
+    extmap::objmap map;
+    map.trim(10, 20);
+    assert(map.size() == 0 && map.begin() == map.end());
+
+    extmap::obj_offset ptr = {1, 0};
+    map.update(10, 20, ptr);
+    map.trim(0, 30);
+    map.trim(40, 50);
+    assert(map.size() == 0 && map.begin() == map.end());
+
+    extmap::bufmap bmap;
+    bmap.trim(0, 8);
+    assert(bmap.size() == 0);
+
+    printf("%s: OK\n", __func__);
+}
+
+
 int primes[] = { 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59,
 		 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
 		 137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197,
@@ -453,6 +617,14 @@ int main(int argc, char **argv)
 	test_3_seq_merge();
     if (in_mask(mask, 7))
 	test_7_lookup();
+    if (in_mask(mask, 10))
+	test_10_obj_table();
+    if (in_mask(mask, 11))
+	test_11_compln();
+    if (in_mask(mask, 12))
+	test_12_crc32c();
+    if (in_mask(mask, 13))
+	test_13_trim_empty();
 
     if (argc > 2)
 	return 0;
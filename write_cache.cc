@@ -59,7 +59,7 @@ class write_cache_impl : public write_cache {
     std::condition_variable write_cv;
 
     void evict(page_t base, page_t len);
-    void send_writes(void);
+    void send_writes(std::unique_lock<std::mutex> *lk);
 
     /* initialization stuff
      */
@@ -67,6 +67,24 @@ class write_cache_impl : public write_cache {
     int roll_log_forward();
     char *_hdrbuf;		// for reading at startup
 
+    /* after a crash, journal records the backend may not have are
+     * re-sent by replay_thread, after open has returned. They stay
+     * pinned (see journal_room) until they've been sent, and newer
+     * writes pass replay_seq as their cache sequence number, so that
+     * a crash in the meantime replays from the same point.
+     */
+    struct replay_rec {
+	uint64_t seq;
+	page_t   page;		// header
+	page_t   len;		// including header
+	std::vector<j_extent> extents;
+	bool     trim;		// LSVD_J_TRIM, no data
+    };
+    std::vector<replay_rec> replay_recs;
+    std::atomic<uint64_t> replay_seq = UINT64_MAX; // oldest not sent
+    void replay_trims(void);
+    void replay_thread(thread_pool<int> *p);
+
     /* 
      * track contents of the write cache. 
      *    before:         after:     
@@ -98,6 +116,18 @@ class write_cache_impl : public write_cache {
     };
     std::set<write_record> outstanding;
     page_t next_acked_page = 0;
+
+    /* with cfg->xlate_refs, translate batches point at data in the
+     * journal, and records with seq >= be->oldest_ref() can't be
+     * overwritten. Track where each data record is so get_room()
+     * can hold writers back, and so we never allocate over one
+     * (journal_clear).
+     */
+    std::map<uint64_t,page_t> rec_page;	// seq -> header page
+    std::map<page_t,uint64_t> page_rec;
+    void forget_record(page_t page);
+    bool journal_room(page_t pages);
+    bool journal_clear(page_t pages);
     void notify_complete(uint64_t seq, std::unique_lock<std::mutex> &lk);
     void record_outstanding(uint64_t seq, page_t next, wcache_write_req *req);
 
@@ -136,10 +166,12 @@ public:
     ~write_cache_impl();
 
     write_cache_work *writev(request *req, sector_t lba, smartiov *iov);
+    write_cache_work *trim(request *req, sector_t lba, sector_t sectors);
     virtual std::tuple<size_t,size_t,request*> 
         async_read(size_t offset, char *buf, size_t bytes);
     virtual std::tuple<size_t,size_t,request*> 
         async_readv(size_t offset, smartiov *iov);
+    void invalidate(void);
 
     /* debug functions */
 
@@ -177,11 +209,14 @@ void print_pages(write_cache_impl *w, const char *file) {
 
 /* ------------- batched write request ------------- */
 
+static const sector_t max_j_trim = 1 << 23; // j_extent.len is 24 bits
+
 class wcache_write_req : public request {
     std::atomic<int> reqs = 0;
 
     sector_t      plba;
     uint64_t      seq;
+    bool          trim = false;	// header-only LSVD_J_TRIM record
     
     std::vector<write_cache_work*> work;
     request      *r_data = NULL;
@@ -201,7 +236,8 @@ public:
     ~wcache_write_req();
     void run(request *parent);
     void notify(request *child);
-    void notify_in_order(std::unique_lock<std::mutex> &lk);
+    void notify_in_order(void);
+    void complete(void);
     
     void wait() {}
     void release() {}		// TODO: free properly
@@ -247,20 +283,35 @@ wcache_write_req::wcache_write_req(std::vector<write_cache_work*> *work_,
 	r_pad = wcache->nvme_w->make_write_request(&pad_iov, pad*4096L);
     }
   
+    /* trims are split to fit the 24-bit extent length
+     */
     std::vector<j_extent> extents;
     for (auto w : work) {
-	extents.push_back((j_extent){(uint64_t)w->lba, w->iov->bytes() / 512});
+	if (w->iov != NULL) {
+	    extents.push_back((j_extent){(uint64_t)w->lba, w->iov->bytes() / 512});
+	    continue;
+	}
+	trim = true;
+	for (sector_t s = 0; s < w->sectors; s += max_j_trim)
+	    extents.push_back((j_extent){(uint64_t)(w->lba + s),
+			(uint64_t)std::min(w->sectors - s, max_j_trim)});
     }
+    assert(sizeof(j_hdr) + extents.size() * sizeof(j_extent) <= 4096);
 
     /* TODO: don't assign seq# in mk_header
      */
     hdr = (char*)aligned_alloc(512, 4096);
-    j_hdr *j = wcache->mk_header(hdr, LSVD_J_DATA, 1+n_pages, prev);
+    j_hdr *j = wcache->mk_header(hdr, trim ? LSVD_J_TRIM : LSVD_J_DATA,
+				 1+n_pages, prev);
     seq = j->seq;
     
     /* track completion 
      */
     wcache->record_outstanding(seq, page+n_pages+1, this);
+    if (wcache->cfg->xlate_refs) {
+	wcache->rec_page[seq] = page;
+	wcache->page_rec[page] = seq;
+    }
 
     j->extent_offset = sizeof(*j);
     size_t e_bytes = extents.size() * sizeof(j_extent);
@@ -272,6 +323,8 @@ wcache_write_req::wcache_write_req(std::vector<write_cache_work*> *work_,
     data_iovs = new smartiov();
     data_iovs->push_back((iovec){hdr, 4096});
     for (auto w : work) {
+	if (trim)
+	    break;
 	auto [iov, iovcnt] = w->iov->c_iov();
 	data_iovs->ingest(iov, iovcnt);
 	i += w->iov->bytes() / 512;
@@ -290,13 +343,17 @@ wcache_write_req::~wcache_write_req() {
 /* called in order from notify_complete
  * write cache lock must be held
  */
-void wcache_write_req::notify_in_order(std::unique_lock<std::mutex> &lk) {
+void wcache_write_req::notify_in_order(void) {
     auto _plba = plba;
 
     /* update the write cache forward and reverse maps
      */
     std::vector<extmap::lba2lba> garbage; 
     for (auto w : work) {
+	if (trim) {
+	    wcache->map.trim(w->lba, w->lba + w->sectors, &garbage);
+	    continue;
+	}
 	sector_t sectors = w->iov->bytes() / 512;
 	wcache->map.update(w->lba, w->lba + sectors, _plba, &garbage);
 	wcache->rmap.update(_plba, _plba+sectors, w->lba);
@@ -312,21 +369,35 @@ void wcache_write_req::notify_in_order(std::unique_lock<std::mutex> &lk) {
     wcache->outstanding_writes--;
     if (wcache->work.size() >= wcache->write_batch ||
 	wcache->work_sectors >= wcache->cfg->wcache_chunk / 512)
-	wcache->send_writes();
+	wcache->send_writes(NULL);
 
     /* send data to backend, invoke callbacks, then clean up
      */
+    _plba = plba;
+    uint64_t cache_seq = std::min(seq, wcache->replay_seq.load());
     for (auto w : work) {
+	if (trim) {
+	    wcache->be->trim(cache_seq, w->lba*512, w->sectors*512);
+	    continue;
+	}
 	auto [iov, iovcnt] = w->iov->c_iov();
 	//check_crc(lba, iov, iovcnt, "3");
-	wcache->be->writev(seq, w->lba*512, iov, iovcnt);
+	if (wcache->cfg->xlate_refs)
+	    wcache->be->writev_ref(cache_seq, w->lba*512, w->iov->bytes(),
+				   _plba*512);
+	else
+	    wcache->be->writev(cache_seq, w->lba*512, iov, iovcnt);
+	_plba += w->iov->bytes() / 512;
     }
-    lk.unlock();
+}
+
+/* invoke callbacks, then clean up. Called without the lock.
+ */
+void wcache_write_req::complete(void) {
     for (auto w : work) {
 	w->req->notify((request*)w);
 	delete w;
     }
-    lk.lock();
     
     /* we don't implement release or wait - just delete ourselves.
      */
@@ -358,9 +429,61 @@ void write_cache_impl::get_room(sector_t sectors) {
     std::unique_lock lk(m);
     while (total_write_pages + pages > max_write_pages)
 	write_cv.wait(lk);
+
+    /* translate doesn't tell us when it's done with a record, so poll
+     */
+    while ((cfg->xlate_refs || replay_seq != UINT64_MAX) &&
+	   !journal_room(pages))
+	write_cv.wait_for(lk, std::chrono::milliseconds(10));
     total_write_pages += pages;
 }
 
+/* can we write @pages (plus what's queued, and room to pad at the
+ * end of the journal) without reaching a record that translate still
+ * needs? Caller holds m
+ */
+bool write_cache_impl::journal_room(page_t pages) {
+    auto it = rec_page.lower_bound(std::min(be->oldest_ref(),
+					    replay_seq.load()));
+    if (it == rec_page.end())
+	return true;
+
+    page_t pinned = it->second, next = super->next, avail;
+    if (pinned >= next)
+	avail = pinned - next;
+    else
+	avail = (super->limit - next) + (pinned - super->base);
+
+    page_t slack = 2 * div_round_up(cfg->wcache_chunk, 4096);
+    return avail > total_write_pages + pages + slack;
+}
+
+/* get_room only keeps writers away from pinned records on average.
+ * Would allocate(@pages) overwrite the oldest one? Records are in the
+ * journal in sequence order, so that's the first one it would reach.
+ * Caller holds m
+ */
+bool write_cache_impl::journal_clear(page_t pages) {
+    auto it = rec_page.lower_bound(std::min(be->oldest_ref(),
+					    replay_seq.load()));
+    if (it == rec_page.end())
+	return true;
+
+    page_t pinned = it->second, next = super->next;
+    if (next + pages <= super->limit)
+	return pinned < next || pinned >= next + pages;
+    return pinned < next && pinned >= super->base + pages; // wraps
+}
+
+void write_cache_impl::forget_record(page_t page) {
+    auto it = page_rec.find(page);
+    if (it == page_rec.end())
+	return;
+    assert(it->second < std::min(be->oldest_ref(), replay_seq.load()));
+    rec_page.erase(it->second);
+    page_rec.erase(it);
+}
+
 void write_cache_impl::release_room(sector_t sectors) {
     int pages = sectors / 8;
     std::unique_lock lk(m);
@@ -371,7 +494,8 @@ void write_cache_impl::release_room(sector_t sectors) {
 
 void write_cache_impl::flush(void) {
     std::unique_lock lk(m);
-    while (total_write_pages > 0 || outstanding.size() > 0)
+    while (total_write_pages > 0 || outstanding.size() > 0 ||
+	   replay_seq != UINT64_MAX)
 	write_cv.wait(lk);
 }
 
@@ -414,6 +538,7 @@ again:
 	if (end < start + n) {
 	    auto it = after.begin();
 	    evict(it->page, it->page + it->len);
+	    forget_record(it->page);
 	    end = it->page + it->len;
 	    after.erase(it);
 	}
@@ -460,8 +585,15 @@ void write_cache_impl::notify_complete(uint64_t seq,
 	it = outstanding.erase(it);
     }
 
+    /* hand all of them to the backend before dropping the lock, so
+     * a later completion can't get there first
+     */
     for (auto r : reqs)
-	r->notify_in_order(lk);
+	r->notify_in_order();
+    lk.unlock();
+    for (auto r : reqs)
+	r->complete();
+    lk.lock();
     write_cv.notify_all();
 }
 
@@ -496,7 +628,7 @@ void write_cache_impl::flush_thread(thread_pool<int> *p) {
 	if (!p->running)
 	    return;
 	if (outstanding_writes == 0 && work.size() > 0)
-	    send_writes();
+	    send_writes(NULL);
     }
 }
 
@@ -647,7 +779,8 @@ int write_cache_impl::roll_log_forward() {
 
     /* nothing in cache
      */
-    if (h->magic != LSVD_MAGIC || h->type != LSVD_J_DATA) {
+    if (h->magic != LSVD_MAGIC ||
+	(h->type != LSVD_J_DATA && h->type != LSVD_J_TRIM)) {
 	sequence = 1;
 	super->next = next_acked_page = super->base;
 	// before = after = {}
@@ -664,15 +797,16 @@ int write_cache_impl::roll_log_forward() {
 	if (nvme_w->read(_hdrbuf, 4096, 4096L * prev) < 0)
 	    throw_fs_error("cache log roll-forward");
 	if (h->magic != LSVD_MAGIC || h->seq != sequence-1 ||
-	    (h->type != LSVD_J_DATA && h->type != LSVD_J_PAD))
+	    (h->type != LSVD_J_DATA && h->type != LSVD_J_PAD &&
+	     h->type != LSVD_J_TRIM))
 	    break;
 	sequence = h->seq;
 	start = prev;
     }
 
-    /* Read all the records in, update lengths and map, and write
-     * to backend if they're newer than the last write the translation
-     * layer guarantees is persisted.
+    /* Read all the record headers, update lengths and map, and queue
+     * records for replay_thread if they're newer than the last write
+     * the translation layer guarantees is persisted.
      */
     while (true) {
 	/* handle wrap-around
@@ -689,7 +823,8 @@ int write_cache_impl::roll_log_forward() {
 	if (nvme_w->read(_hdrbuf, 4096, 4096L * start) < 0)
 	    throw_fs_error("cache log roll-forward");
 	if (h->magic != LSVD_MAGIC || h->seq != sequence ||
-	    (h->type != LSVD_J_DATA && h->type != LSVD_J_PAD))
+	    (h->type != LSVD_J_DATA && h->type != LSVD_J_PAD &&
+	     h->type != LSVD_J_TRIM))
 	    break;
 
 	if (h->type == LSVD_J_PAD) {
@@ -700,59 +835,139 @@ int write_cache_impl::roll_log_forward() {
 	
 	before.push_back({start, h->len});
 
-	/* read LBA info from header, read data, then 
-	 * - put mappings into cache map and rmap
-	 * - write data to backend
+	/* read LBA info from header, then put mappings into cache
+	 * map and rmap
 	 */
 	std::vector<j_extent> entries;
 	decode_offset_len<j_extent>(_hdrbuf, h->extent_offset,
 				    h->extent_len, entries);
 
-	size_t data_len = 4096L * (h->len - 1);
-	char *data = (char*)aligned_alloc(512, data_len);
-	if (nvme_w->read(data, data_len, 4096L * (start+1)) < 0)
-	    throw_fs_error("wcache");
-
 	sector_t plba = (start+1) * 8;
-	size_t offset = 0;
 	std::vector<extmap::lba2lba> garbage;
-
-	/* all write batches with sequence < max_cache_seq are
-	 * guaranteed to be persisted in the backend already
-	 */
+	bool trim = (h->type == LSVD_J_TRIM);
+	bool stale = (sequence < super->valid_seq && // see invalidate()
+		      sequence < be->max_cache_seq);
 	for (auto e : entries) {
+	    if (stale)
+		break;
+	    if (trim) {
+		map.trim(e.lba, e.lba+e.len, &garbage);
+		continue;
+	    }
 	    map.update(e.lba, e.lba+e.len, plba, &garbage);
 	    rmap.update(plba, plba+e.len, e.lba);
-
-	    size_t bytes = e.len * 512;
-	    iovec iov = {data+offset, bytes};
-	    if (sequence >= be->max_cache_seq) {
-		do_log("write %ld %d+%d\n", sequence.load(), (int)e.lba, e.len);
-		be->writev(sequence, e.lba*512, &iov, 1);
-	    }
-	    else
-		do_log("skip %ld %d (max %d) %ld+%d\n", start,
-		       sequence.load(), be->max_cache_seq, e.lba, e.len);
-	    offset += bytes;
 	    plba += e.len;
 	}
 	for (auto g : garbage)
-	    rmap.trim(g.s.base, g.s.base+g.s.len);	    
+	    rmap.trim(g.s.ptr, g.s.ptr+g.s.len);
 
-	free(data);
+	/* all write batches with sequence < max_cache_seq are
+	 * guaranteed to be persisted in the backend already
+	 */
+	if (sequence >= be->max_cache_seq) {
+	    replay_recs.push_back((replay_rec){sequence, start, h->len,
+			entries, trim});
+	    rec_page[sequence] = start;
+	    page_rec[start] = sequence;
+	}
+	else
+	    do_log("skip %ld %d (max %d)\n", start,
+		   sequence.load(), be->max_cache_seq);
 
 	start += h->len;
 	sequence++;
     }
 
     super->next = next_acked_page = start;
-    
-    be->flush();
-    usleep(10000);
+    if (replay_recs.size() > 0)
+	replay_seq = replay_recs.front().seq;
     
     return 0;
 }
 
+/* send journal records found by roll_log_forward to the backend, in
+ * order, skipping data that's been overwritten since. Holding m while
+ * we call be->writev keeps them ordered with new writes (see
+ * notify_in_order)
+ */
+void write_cache_impl::replay_thread(thread_pool<int> *p) {
+    pthread_setname_np(pthread_self(), "wcache_replay");
+    
+    for (size_t i = 0; i < replay_recs.size(); i++) {
+	auto &r = replay_recs[i];
+	if (!p->running)
+	    return;
+	be->wait_for_room();	// flow control
+
+	if (r.trim) {		// already sent by replay_trims
+	    std::unique_lock lk(m);
+	    replay_seq = (i+1 < replay_recs.size()) ?
+		replay_recs[i+1].seq : UINT64_MAX;
+	    write_cv.notify_all();
+	    continue;
+	}
+
+	size_t data_len = 4096L * (r.len - 1);
+	char *data = (char*)aligned_alloc(512, data_len);
+	if (nvme_w->read(data, data_len, 4096L * (r.page+1)) < 0)
+	    throw_fs_error("wcache");
+
+	std::unique_lock lk(m);
+	sector_t plba = (r.page+1) * 8;
+	size_t offset = 0;
+	for (auto e : r.extents) {
+	    sector_t limit = e.lba + e.len;
+	    for (auto it = map.lookup(e.lba);
+		 it != map.end() && it->base() < limit; it++) {
+		auto [_base, _limit, ptr] = it->vals(e.lba, limit);
+		if (ptr != plba + (_base - (sector_t)e.lba))
+		    continue;	// overwritten
+		do_log("write %ld %d+%d\n", r.seq, (int)_base,
+		       (int)(_limit - _base));
+		iovec iov = {data + offset + 512 * (_base - e.lba),
+			     (size_t)(_limit - _base) * 512};
+		be->writev(r.seq, _base*512, &iov, 1);
+	    }
+	    offset += e.len * 512;
+	    plba += e.len;
+	}
+	replay_seq = (i+1 < replay_recs.size()) ?
+	    replay_recs[i+1].seq : UINT64_MAX;
+	write_cv.notify_all();
+	lk.unlock();
+	free(data);
+    }
+    do_log("wcache: replayed %d records\n", (int)replay_recs.size());
+    replay_recs.clear();
+    be->flush();
+}
+
+/* trims found by roll_log_forward go to the backend before open
+ * returns - reads of a discarded range miss in our map, and would see
+ * the old data until replay_thread got there. Only the parts that
+ * haven't been written since, and with the oldest replay sequence
+ * number, so a crash before the older records are re-sent replays
+ * everything again.
+ */
+void write_cache_impl::replay_trims(void) {
+    for (auto &r : replay_recs) {
+	if (!r.trim)
+	    continue;
+	for (auto e : r.extents) {
+	    sector_t base = e.lba, limit = e.lba + e.len;
+	    for (auto it = map.lookup(base);
+		 it != map.end() && it->base() < limit; it++) {
+		auto [_base, _limit, ptr] = it->vals(base, limit);
+		if (_base > base)
+		    be->trim(replay_seq, base*512, (_base - base)*512);
+		base = _limit;
+	    }
+	    if (base < limit)
+		be->trim(replay_seq, base*512, (limit - base)*512);
+	}
+    }
+}
+
 write_cache_impl::write_cache_impl( uint32_t blkno, int fd, translate *_be,
 				    lsvd_config *cfg_) {
     super_blkno = blkno;
@@ -764,6 +979,8 @@ write_cache_impl::write_cache_impl( uint32_t blkno, int fd, translate *_be,
     
     const char *name = "write_cache_cb";
     nvme_w = make_nvme(fd, name);
+    if (cfg->xlate_refs)
+	be->set_journal(nvme_w);
 
     char *buf = (char*)aligned_alloc(512, 4096);
     if (nvme_w->read(buf, 4096, 4096L*super_blkno) < 4096)
@@ -792,6 +1009,10 @@ write_cache_impl::write_cache_impl( uint32_t blkno, int fd, translate *_be,
     misc_threads = new thread_pool<int>(&m);
     misc_threads->pool.push(std::thread(&write_cache_impl::flush_thread,
 					this, misc_threads));
+    replay_trims();
+    if (replay_recs.size() > 0)
+	misc_threads->pool.push(std::thread(&write_cache_impl::replay_thread,
+					    this, misc_threads));
 }
 
 write_cache *make_write_cache(uint32_t blkno, int fd,
@@ -806,14 +1027,30 @@ write_cache_impl::~write_cache_impl() {
     delete nvme_w;
 }
 
-void write_cache_impl::send_writes(void) {
+/* caller holds m. If the record would overwrite one translate still
+ * needs, wait for it to be released if we were passed the lock (the
+ * work may get sent by someone else in the meantime), else leave the
+ * work queued for the next writer or flush_thread.
+ */
+void write_cache_impl::send_writes(std::unique_lock<std::mutex> *lk) {
     sector_t sectors = 0;
-    for (auto w : work) {
-        sectors += w->iov->bytes() / 512;
-        assert(w->iov->aligned(512));
+    page_t pages = 0;
+    for (;;) {
+	sectors = 0;
+	for (auto w : work) {
+	    sectors += w->iov->bytes() / 512;
+	    assert(w->iov->aligned(512));
+	}
+	pages = div_round_up(sectors, 8);
+	if (work.size() == 0 || journal_clear(pages+1))
+	    break;
+	if (lk == NULL)
+	    return;
+	write_cv.wait_for(*lk, std::chrono::milliseconds(10));
     }
-    
-    page_t pages = div_round_up(sectors, 8);
+    if (work.size() == 0)
+	return;
+
     page_t pad, n_pad, prev = 0;
     page_t page = allocate(pages+1, pad, n_pad, prev);
 
@@ -837,7 +1074,32 @@ write_cache_work *write_cache_impl::writev(request *req, sector_t lba, smartiov
     // batch them
     if (outstanding_writes == 0 || work.size() >= write_batch ||
 	work_sectors >= cfg->wcache_chunk / 512)
-	send_writes();
+	send_writes(&lk);
+    return w;
+}
+
+/* discards get their own header-only journal record, after any
+ * writes queued ahead of them
+ */
+write_cache_work *write_cache_impl::trim(request *req, sector_t lba,
+					 sector_t sectors) {
+    assert(sectors <= max_wcache_trim);
+    std::unique_lock lk(m);
+    while (work.size() > 0 || !journal_clear(1)) {
+	if (work.size() > 0)
+	    send_writes(&lk);
+	else
+	    write_cv.wait_for(lk, std::chrono::milliseconds(10));
+    }
+    
+    auto w = new write_cache_work(req, lba, sectors);
+    std::vector<write_cache_work*> _work = {w};
+    page_t pad, n_pad, prev = 0;
+    page_t page = allocate(1, pad, n_pad, prev);
+    auto wreq = new wcache_write_req(&_work, 0, page, n_pad-1, pad,
+				     prev, this);
+    outstanding_writes++;
+    wreq->run(NULL);
     return w;
 }
 
@@ -914,6 +1176,25 @@ void write_cache_impl::getmap(int base, int limit, int (*cb)(void*, int, int, in
     }
 }
 
+/* the backend is going back to a snapshot, so reads can't come from
+ * here any more. Drop the map, and record in the superblock that the
+ * records in the journal are stale, so that crash recovery doesn't map
+ * them again - unless they have to be replayed, which only happens if
+ * we crash before the rollback is done, when they're still current.
+ */
+void write_cache_impl::invalidate(void) {
+    std::unique_lock lk(m);
+    map.reset();
+    rmap.reset();
+
+    j_write_super *super_copy = (j_write_super*)aligned_alloc(512, 4096);
+    memcpy(super_copy, super, 4096);
+    super_copy->valid_seq = super->valid_seq = sequence;
+    if (nvme_w->write((char*)super_copy, 4096, 4096L*super_blkno) < 0)
+	throw_fs_error("wcache");
+    free(super_copy);
+}
+
 void write_cache_impl::reset(void) {
     map.reset();
 }
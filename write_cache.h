@@ -15,10 +15,15 @@ struct write_cache_work {
 public:
     request  *req;
     sector_t  lba;
-    smartiov *iov;
+    smartiov *iov;		// NULL for trim
+    sector_t  sectors = 0;	// trim only
     write_cache_work(request *r, sector_t a, smartiov *v) : req(r), lba(a), iov(v) {}
+    write_cache_work(request *r, sector_t a, sector_t n) :
+        req(r), lba(a), iov(NULL), sectors(n) {}
 };
 
+static const sector_t max_wcache_trim = 1L << 30;
+
 /* all addresses are in units of 4KB blocks
  */
 class write_cache {
@@ -30,11 +35,19 @@ public:
     virtual ~write_cache() {}
 
     virtual write_cache_work* writev(request *req, sector_t lba, smartiov *iov) = 0;
+    /* up to max_wcache_trim sectors, which fit in one journal header
+     */
+    virtual write_cache_work* trim(request *req, sector_t lba, sector_t sectors) = 0;
     virtual std::tuple<size_t,size_t,request*>
         async_read(size_t offset, char* buf, size_t len) = 0;
     virtual std::tuple<size_t,size_t,request*>
         async_readv(size_t offset, smartiov *iovs) = 0;
 
+    /* snapshot rollback: nothing in the cache is current any more.
+     * Call after flush(), before rolling the backend back.
+     */
+    virtual void invalidate(void) = 0;
+
     /* debug stuff 
      */
     virtual void getmap(int base, int limit, int (*cb)(void*,int,int,int),